@@ -44,12 +44,16 @@ int main(void)
 	printf("#define CTX__IJMP_TAINT (0x%lx)\n", (long)offsetof(thread_ctx_t, ijmp_taint));
 	printf("#define CTX__FLAGS_TMP (0x%lx)\n", (long)offsetof(thread_ctx_t, flags_tmp));
 	printf("#define CTX__MY_ADDR (0x%lx)\n", (long)offsetof(thread_ctx_t, my_addr));
+	printf("#define CTX__SIG_PENDING (0x%lx)\n", (long)offsetof(thread_ctx_t, sig_pending));
+	printf("#define CTX__LAZY_SIGSET (0x%lx)\n", (long)offsetof(thread_ctx_t, lazy_sigset));
 	printf("#define CTX__SIZE (0x%lx)\n", (long)sizeof(thread_ctx_t));
 	assert( (sizeof(thread_ctx_t) & 0xfff) == 0);
 	assert( (offsetof(thread_ctx_t, fault_page0) & 0xfff) == 0);
 	assert( (offsetof(thread_ctx_t, sigwrap_stack) & 0xfff) == 0);
 	assert( (offsetof(thread_ctx_t, jit_fragment_page) & 0xfff) == 0);
 	assert( (offsetof(thread_ctx_t, scratch_stack) & 0xfff) == 0);
+	assert( (offsetof(thread_ctx_t, guest_xmm) & 0xf) == 0);
+	assert( (offsetof(thread_ctx_t, xmm_taint) & 0xf) == 0);
 
 	exit(EXIT_SUCCESS);
 }
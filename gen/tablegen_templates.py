@@ -0,0 +1,198 @@
+#!/usr/bin/env python
+#
+# Generates src/jit_templates.h: fixed byte sequences for the code emitted by
+# jit_code.c, together with the offsets of the fields that are filled in at
+# translation time.
+#
+#     python gen/tablegen_templates.py > src/jit_templates.h
+#
+# template syntax:
+#     [0-9A-F]{2}     literal byte
+#     L:name          32 bit little endian field
+#     S:name          16 bit little endian field
+#     R:name          32 bit relative jump / call target
+#     # ...           comment, copied to the generated header
+
+templates = [
+
+('xmm_save', """
+	66 0F 3A 22 E1 00           # pinsrd $0, %ecx, %xmm4
+	66 0F 3A 22 D8 00           # pinsrd $0, %eax, %xmm3
+"""),
+
+('clear_ijmp_taint', """
+	66 0F EF ED                 # pxor %xmm5, %xmm5
+"""),
+
+('hook', """
+	64 C7 05 L:func_off L:func  # movl func, hook
+	64 C7 05 L:rip_off L:addr   # movl addr, user_eip
+	64 C7 05 L:jit_off L:jit    # movl jit_ret, jit_eip
+	E9 R:stub                   # jmp hook_stub
+"""),
+
+('sysenter', """
+	66 0F EF ED                 # pxor %xmm5, %xmm5
+	E9 R:emu                    # jmp linux_sysenter_emu
+"""),
+
+('syscall', """
+	66 0F EF ED                 # pxor %xmm5, %xmm5
+	64 48 C7 04 25 L:rip_off L:addr  # movq $post_addr, user_eip
+	64 48 C7 04 25 L:jit_off L:jit   # movq $post_jit, jit_eip
+	E9 R:emu                    # jmp linux_syscall_emu / linux_syscall_direct
+"""),
+
+('int80', """
+	66 0F EF ED                 # pxor %xmm5, %xmm5
+	64 C7 05 L:rip_off L:addr   # movl $post_addr, user_eip
+	E9 R:emu                    # jmp int80_emu
+"""),
+
+('cpuid', """
+	64 C7 05 L:jit_off L:jit    # movl $post_addr, jit_eip
+	E9 R:emu                    # jmp cpuid_emu
+"""),
+
+('ijump_tail', """
+	66 0F 3A 16 E9 00           # pextrd $0, %xmm5, %ecx
+	E9 R:runtime_ijmp           # jmp runtime_ijmp
+"""),
+
+('call_preseed', """
+	68 L:retaddr                # push $retaddr
+	64 C7 05 L:addr_off L:addr  # movl $addr,     jmp_cache[HASH_INDEX(addr)].addr
+	64 C7 05 L:jit_off L:jit    # movl $jit_addr, jmp_cache[HASH_INDEX(addr)].jit_addr
+"""),
+
+('call_prefetch', """
+	68 L:retaddr                # push $retaddr
+	64 0F 18 0D L:cache_off     # prefetch jmp_cache[HASH_INDEX(addr)]
+"""),
+
+('call_lazy', """
+	68 L:retaddr                # push $retaddr
+"""),
+
+('icall_preseed', """
+	66 0F 3A 16 E9 00           # pextrd $0, %xmm5, %ecx
+	68 L:retaddr                # push $retaddr
+	64 C7 05 L:addr_off L:addr  # movl $addr,     jmp_cache[HASH_INDEX(addr)].addr
+	64 C7 05 L:jit_off L:jit    # movl $jit_addr, jmp_cache[HASH_INDEX(addr)].jit_addr
+	E9 R:runtime_ijmp           # jmp runtime_ijmp
+"""),
+
+('icall_prefetch', """
+	66 0F 3A 16 E9 00           # pextrd $0, %xmm5, %ecx
+	68 L:retaddr                # push $retaddr
+	64 0F 18 0D L:cache_off     # prefetch jmp_cache[HASH_INDEX(addr)]
+	E9 R:runtime_ijmp           # jmp runtime_ijmp
+"""),
+
+('icall_lazy', """
+	66 0F 3A 16 E9 00           # pextrd $0, %xmm5, %ecx
+	68 L:retaddr                # push $retaddr
+	E9 R:runtime_ijmp           # jmp runtime_ijmp
+"""),
+
+('ret_cleanup', """
+	66 0F 3A 22 E1 00           # pinsrd $0, %ecx, %xmm4
+	66 0F 3A 22 D8 00           # pinsrd $0, %eax, %xmm3
+	8B 8C 24 L:taint_off        # mov TAINT_OFFSET(%esp), %ecx
+	58                          # pop %eax
+	8D A4 24 S:n 00 00          # lea N(%esp),%esp
+	E9 R:runtime_ijmp           # jmp runtime_ijmp
+"""),
+
+('cross_map_jump', """
+	66 0F 3A 22 E1 00           # pinsrd $0, %ecx, %xmm4
+	66 0F 3A 22 D8 00           # pinsrd $0, %eax, %xmm3
+	B8 L:jmp_addr               # mov jmp_addr, %eax
+	B9 00 00 00 00              # mov $0x0,%ecx
+	E9 R:runtime_ijmp           # jmp runtime_ijmp
+"""),
+
+('rep_movs_pre', """
+	66 0F 3A 22 E1 00           # pinsrd $0, %ecx, %xmm4
+	66 0F 3A 22 E6 01           # pinsrd $1, %esi, %xmm4
+	66 0F 3A 22 E7 02           # pinsrd $2, %edi, %xmm4
+	8D B6 L:src_off             # lea TAINT_OFFSET(%esi), %esi
+	8D BF L:dst_off             # lea TAINT_OFFSET(%edi), %edi
+"""),
+
+('rep_movs_post', """
+	66 0F 3A 16 E1 00           # pextrd $0, %xmm4, %ecx
+	66 0F 3A 16 E6 01           # pextrd $1, %xmm4, %esi
+	66 0F 3A 16 E7 02           # pextrd $2, %xmm4, %edi
+"""),
+
+('rep_stos_pre', """
+	66 0F 3A 22 E1 00           # pinsrd $0, %ecx, %xmm4
+	66 0F 3A 22 E7 02           # pinsrd $2, %edi, %xmm4
+	66 0F 3A 22 E0 03           # pinsrd $3, %eax, %xmm4
+	66 0F 3A 16 F0 00           # pextrd $0, %xmm6, %eax
+	8D BF L:dst_off             # lea TAINT_OFFSET(%edi), %edi
+"""),
+
+('rep_stos_post', """
+	66 0F 3A 16 E1 00           # pextrd $0, %xmm4, %ecx
+	66 0F 3A 16 E7 02           # pextrd $2, %xmm4, %edi
+	66 0F 3A 16 E0 03           # pextrd $3, %xmm4, %eax
+"""),
+
+('backedge_check', """
+	66 0F 3A 22 E1 00           # pinsrd $0, %ecx, %xmm4
+	64 8B 0C 25 L:live_off      # mov %fs:taint_live, %ecx
+	E3 15                       # jrcxz 1f
+	66 0F 3A 22 D8 00           # pinsrd $0, %eax, %xmm3
+	B8 L:jmp_addr               # mov jmp_addr, %eax
+	B9 00 00 00 00              # mov $0x0,%ecx
+	E9 R:runtime_ijmp           # jmp runtime_ijmp
+	66 0F 3A 16 E1 00           # 1: pextrd $0, %xmm4, %ecx
+	E9 R:target                 # jmp target
+"""),
+
+]
+
+field_size = { 'L':4, 'S':2, 'R':4 }
+
+def parse(text):
+	code, fields, comments = [], [], []
+	for line in text.strip().split('\n'):
+		line, _, comment = line.partition('#')
+		comments.append(comment.strip())
+		for tok in line.split():
+			if ':' in tok:
+				kind, name = tok.split(':')
+				fields.append( (name, len(code)) )
+				code.extend( [0]*field_size[kind] )
+			else:
+				code.append(int(tok, 16))
+	return code, fields, comments
+
+print("/* generated by gen/tablegen_templates.py, do not edit */")
+print("")
+print("#ifndef JIT_TEMPLATES_H")
+print("#define JIT_TEMPLATES_H")
+
+for name, text in templates:
+	code, fields, comments = parse(text)
+	print("")
+	print("/* " + name + ":")
+	for c in comments:
+		print(" *     " + c)
+	print(" */")
+	print("static const unsigned char tpl_" + name + "[] =")
+	print("{")
+	for i in range(0, len(code), 12):
+		print("\t" + ' '.join("0x%02X," % b for b in code[i:i+12]))
+	print("};")
+	if fields:
+		print("enum")
+		print("{")
+		for fname, off in fields:
+			print("\tTPL_" + name.upper() + "_" + fname.upper() + " = " + str(off) + ",")
+		print("};")
+
+print("")
+print("#endif /* JIT_TEMPLATES_H */")
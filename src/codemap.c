@@ -27,6 +27,7 @@
 #include "codemap.h"
 #include "runtime.h"
 #include "threads.h"
+#include "jit_spec.h"
 
 #define MAX_CODEMAPS (32768)
 
@@ -53,22 +54,26 @@ static void del_code_map(unsigned int i)
 
 	if (orig.jit_addr)
 		clear_code_map(orig.addr, orig.len, orig.jit_addr);
+
+	if (orig.bare_jit_addr)
+		jit_mem_free(orig.bare_jit_addr);
 }
 
-code_map_t *find_code_map(char *addr)
+static code_map_t *find_code_map_locked(char *addr)
 {
-	mutex_lock(&codemap_lock);
-
 	unsigned int i;
-	code_map_t *map = NULL;
 
 	for (i=0; i<n_codemaps; i++)
 		if (contains(codemaps[i].addr, codemaps[i].len, addr))
-		{
-			map = &codemaps[i];
-			break;
-		}
+			return &codemaps[i];
+
+	return NULL;
+}
 
+code_map_t *find_code_map(char *addr)
+{
+	mutex_lock(&codemap_lock);
+	code_map_t *map = find_code_map_locked(addr);
 	mutex_unlock(&codemap_lock);
 
 	return map;
@@ -82,7 +87,8 @@ code_map_t *find_jit_code_map(char *jit_addr)
 	code_map_t *map = NULL;
 
 	for (i=0; i<n_codemaps; i++)
-		if (contains(codemaps[i].jit_addr, codemaps[i].jit_len, jit_addr))
+		if (contains(codemaps[i].jit_addr, codemaps[i].jit_len, jit_addr) ||
+		    contains(codemaps[i].bare_jit_addr, codemaps[i].bare_jit_len, jit_addr))
 		{
 			map = &codemaps[i];
 			break;
@@ -135,9 +141,31 @@ void add_code_region(char *addr, unsigned long len, unsigned long long inode,
 	mutex_unlock(&codemap_lock);
 }
 
+/* copies the code map containing addr, returns 0 if there is none */
+int get_code_map(char *addr, code_map_t *copy)
+{
+	code_map_t *map;
+
+	mutex_lock(&codemap_lock);
+	map = find_code_map_locked(addr);
+	if (map)
+		*copy = *map;
+	mutex_unlock(&codemap_lock);
+
+	return map != NULL;
+}
+
 void del_code_region(char *addr, unsigned long len)
 {
 	mutex_lock(&jit_lock);     /* since we might throw away code */
+	del_code_region_locked(addr, len);
+	mutex_unlock(&jit_lock);
+}
+
+/* caller holds jit_lock */
+void del_code_region_locked(char *addr, unsigned long len)
+{
+	jit_spec_forget(addr, len);
 	mutex_lock(&codemap_lock);
 	int i = n_codemaps-1;
 
@@ -154,6 +182,8 @@ void del_code_region(char *addr, unsigned long len)
 
 		map.jit_addr = NULL;
 		map.jit_len = 0;
+		map.bare_jit_addr = NULL;
+		map.bare_jit_len = 0;
 
 		unsigned long start = (unsigned long)addr,
 		              end = start + len,
@@ -178,6 +208,29 @@ void del_code_region(char *addr, unsigned long len)
 		i = n_codemaps-1;
 	}
 	mutex_unlock(&codemap_lock);
-	mutex_unlock(&jit_lock);
 }
 
+/* Drops all translations so that code gets translated again on its next
+ * use, the old code is kept for threads that are still running it.
+ * Only done once, when taint becomes live.  Caller holds jit_lock.
+ */
+void retire_jit_code(void)
+{
+	unsigned int i;
+
+	mutex_lock(&codemap_lock);
+
+	for (i=0; i<n_codemaps; i++)
+		if (codemaps[i].jit_addr)
+		{
+			codemaps[i].bare_jit_addr = codemaps[i].jit_addr;
+			codemaps[i].bare_jit_len = codemaps[i].jit_len;
+			codemaps[i].jit_len = 0;
+			commit();
+			codemaps[i].jit_addr = NULL;
+		}
+
+	mutex_unlock(&codemap_lock);
+
+	purge_caches((char *)USER_START, USER_SIZE);
+}
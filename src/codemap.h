@@ -30,6 +30,12 @@ typedef struct
 	unsigned long long inode, dev;
 	unsigned long mtime, pgoffset;
 
+	/* bare code from before taint became live, kept for threads
+	 * that may still be running it, see retire_jit_code()
+	 */
+	char *bare_jit_addr;
+	unsigned long bare_jit_len;
+
 } code_map_t;
 
 code_map_t *find_code_map(char *addr);
@@ -40,6 +46,11 @@ void add_code_region(char *addr, unsigned long len, unsigned long long inode,
                                                     unsigned long mtime,
                                                     unsigned long pgoffset);
 
+int get_code_map(char *addr, code_map_t *copy);
+
 void del_code_region(char *addr, unsigned long len);
+void del_code_region_locked(char *addr, unsigned long len);
+
+void retire_jit_code(void);
 
 #endif /* CODEMAP_H */
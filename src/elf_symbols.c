@@ -0,0 +1,284 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <string.h>
+
+#include "lib.h"
+#include "elf_symbols.h"
+#include "threads.h"
+
+#define MAX_PHDRS (64)
+#define SYM_BATCH (64)
+#define SYM_NAME_MAX (32)
+
+static long vaddr_to_offset(Elf64_Phdr *phdr, long phnum, unsigned long vaddr)
+{
+	long i;
+
+	for (i=0; i<phnum; i++)
+		if ( (phdr[i].p_type == PT_LOAD) && (phdr[i].p_flags & PF_X) &&
+		     (vaddr >= phdr[i].p_vaddr) &&
+		     (vaddr <  phdr[i].p_vaddr+phdr[i].p_filesz) )
+			return vaddr - phdr[i].p_vaddr + phdr[i].p_offset;
+
+	return -1;
+}
+
+static long find_symtab(int fd, Elf64_Ehdr *hdr, Elf64_Shdr *symtab)
+{
+	Elf64_Shdr shdr;
+	long i, found = 0;
+
+	for (i=0; i<hdr->e_shnum; i++)
+	{
+		if ( read_at(fd, hdr->e_shoff+i*sizeof(shdr), &shdr, sizeof(shdr)) != sizeof(shdr) )
+			return -EIO;
+
+		/* prefer the full symbol table over the dynamic one */
+		if ( (shdr.sh_type == SHT_SYMTAB) ||
+		     ((shdr.sh_type == SHT_DYNSYM) && !found) )
+		{
+			*symtab = shdr;
+			found = 1;
+		}
+	}
+
+	return found ? 0 : -ENOENT;
+}
+
+static long walk_func_symbols(int fd, elf_symbol_func_t func,
+                              elf_named_symbol_func_t named_func, void *arg)
+{
+	Elf64_Ehdr hdr;
+	Elf64_Phdr phdr[MAX_PHDRS];
+	Elf64_Shdr symtab, strtab;
+	Elf64_Sym sym[SYM_BATCH];
+	char name[SYM_NAME_MAX];
+	long i, j, n, off, err, count = 0;
+
+	if ( read_at(fd, 0, &hdr, sizeof(hdr)) != sizeof(hdr) )
+		return -EIO;
+
+	if ( (memcmp(&hdr, ELFMAG, SELFMAG) != 0) ||
+	     (hdr.e_ident[EI_CLASS] != ELFCLASS64) ||
+	     (hdr.e_phentsize != sizeof(Elf64_Phdr)) ||
+	     (hdr.e_phnum > MAX_PHDRS) ||
+	     (hdr.e_shentsize != sizeof(Elf64_Shdr)) )
+		return -ENOEXEC;
+
+	n = hdr.e_phnum*sizeof(Elf64_Phdr);
+	if ( read_at(fd, hdr.e_phoff, phdr, n) != n )
+		return -EIO;
+
+	if ( (err = find_symtab(fd, &hdr, &symtab)) < 0 )
+		return err;
+
+	if ( symtab.sh_entsize != sizeof(Elf64_Sym) )
+		return -ENOEXEC;
+
+	if ( named_func && ( (symtab.sh_link >= hdr.e_shnum) ||
+	     (read_at(fd, hdr.e_shoff+symtab.sh_link*sizeof(strtab), &strtab,
+	              sizeof(strtab)) != sizeof(strtab)) ) )
+		return -ENOEXEC;
+
+	long n_syms = symtab.sh_size/sizeof(Elf64_Sym);
+
+	for (i=0; i<n_syms; i+=SYM_BATCH)
+	{
+		n = n_syms-i < SYM_BATCH ? n_syms-i : SYM_BATCH;
+		if ( read_at(fd, symtab.sh_offset+i*sizeof(Elf64_Sym), sym,
+		             n*sizeof(Elf64_Sym)) != n*(long)sizeof(Elf64_Sym) )
+			return -EIO;
+
+		for (j=0; j<n; j++)
+		{
+			if ( (ELF64_ST_TYPE(sym[j].st_info) != STT_FUNC) ||
+			     (sym[j].st_shndx == SHN_UNDEF) || (sym[j].st_value == 0) )
+				continue;
+
+			off = vaddr_to_offset(phdr, hdr.e_phnum, sym[j].st_value);
+			if (off < 0)
+				continue;
+
+			if (named_func)
+			{
+				if ( read_at(fd, strtab.sh_offset+sym[j].st_name,
+				             name, sizeof(name)) <= 0 )
+					continue;
+
+				name[sizeof(name)-1] = '\0';
+				named_func(name, off, sym[j].st_size, arg);
+			}
+			else
+				func(off, sym[j].st_size, arg);
+
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/* Walks the .symtab (or .dynsym if the file is stripped) of an ELF file,
+ * returns the number of function symbols found or a negative error code.
+ * Only uses a small amount of stack, since it runs on the scratch stack.
+ */
+long elf_func_symbols(int fd, elf_symbol_func_t func, void *arg)
+{
+	return walk_func_symbols(fd, func, NULL, arg);
+}
+
+/* Same, but passes the symbol names as well, names longer than
+ * SYM_NAME_MAX-1 get truncated.
+ */
+long elf_named_func_symbols(int fd, elf_named_symbol_func_t func, void *arg)
+{
+	return walk_func_symbols(fd, NULL, func, arg);
+}
+
+/* Function extents of mapped executables, keyed by file, sorted by offset
+ * per file.  Filled in when an executable gets mapped, used to translate
+ * whole functions at a time.
+ */
+
+#define MAX_SYM_FILES (512)
+#define MAX_FUNC_SYMS (0x20000)
+
+typedef struct
+{
+	unsigned long off, size;
+
+} func_sym_t;
+
+typedef struct
+{
+	unsigned long long inode, dev;
+	unsigned long mtime, first, count;
+
+} sym_file_t;
+
+static sym_file_t sym_files[MAX_SYM_FILES];
+static func_sym_t func_syms[MAX_FUNC_SYMS];
+static unsigned long n_sym_files = 0, n_func_syms = 0;
+static long sym_lock = 0;
+
+static sym_file_t *find_sym_file(unsigned long long inode, unsigned long long dev,
+                                 unsigned long mtime)
+{
+	unsigned long i;
+
+	for (i=0; i<n_sym_files; i++)
+		if ( (sym_files[i].inode == inode) && (sym_files[i].dev == dev) &&
+		     (sym_files[i].mtime == mtime) )
+			return &sym_files[i];
+
+	return NULL;
+}
+
+static void add_func_symbol(unsigned long offset, unsigned long size, void *arg)
+{
+	if ( (size == 0) || (n_func_syms >= MAX_FUNC_SYMS) )
+		return;
+
+	func_syms[n_func_syms] = (func_sym_t){ .off = offset, .size = size };
+	n_func_syms++;
+}
+
+/* shell sort, no recursion on the scratch stack */
+static void sort_func_syms(func_sym_t *syms, unsigned long n)
+{
+	unsigned long gap, i, j;
+	func_sym_t tmp;
+
+	for (gap=n/2; gap>0; gap/=2)
+		for (i=gap; i<n; i++)
+		{
+			tmp = syms[i];
+			for (j=i; j>=gap && syms[j-gap].off > tmp.off; j-=gap)
+				syms[j] = syms[j-gap];
+			syms[j] = tmp;
+		}
+}
+
+void load_func_symbols(int fd, unsigned long long inode, unsigned long long dev,
+                               unsigned long mtime)
+{
+	if (inode == 0)
+		return;
+
+	mutex_lock(&sym_lock);
+
+	if ( (n_sym_files < MAX_SYM_FILES) && !find_sym_file(inode, dev, mtime) )
+	{
+		sym_file_t *f = &sym_files[n_sym_files];
+		*f = (sym_file_t){ .inode = inode, .dev = dev, .mtime = mtime,
+		                   .first = n_func_syms };
+
+		if ( elf_func_symbols(fd, add_func_symbol, NULL) >= 0 )
+		{
+			f->count = n_func_syms - f->first;
+			sort_func_syms(&func_syms[f->first], f->count);
+			n_sym_files++;
+		}
+		else
+			n_func_syms = f->first;
+	}
+
+	mutex_unlock(&sym_lock);
+}
+
+/* finds the function containing file offset offset */
+int find_func_symbol(unsigned long long inode, unsigned long long dev,
+                     unsigned long mtime, unsigned long offset,
+                     unsigned long *start, unsigned long *size)
+{
+	int found = 0;
+
+	mutex_lock(&sym_lock);
+
+	sym_file_t *f = find_sym_file(inode, dev, mtime);
+
+	if (f && f->count)
+	{
+		func_sym_t *syms = &func_syms[f->first];
+		unsigned long lo = 0, hi = f->count, mid;
+
+		/* last symbol starting at or before offset */
+		while (hi-lo > 1)
+		{
+			mid = (lo+hi)/2;
+			if (syms[mid].off <= offset)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		if ( (syms[lo].off <= offset) && (offset < syms[lo].off+syms[lo].size) )
+		{
+			*start = syms[lo].off;
+			*size = syms[lo].size;
+			found = 1;
+		}
+	}
+
+	mutex_unlock(&sym_lock);
+
+	return found;
+}
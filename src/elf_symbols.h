@@ -0,0 +1,41 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ELF_SYMBOLS_H
+#define ELF_SYMBOLS_H
+
+/* called for every defined function symbol in an executable segment,
+ * offset is the file offset of the function
+ */
+typedef void (*elf_symbol_func_t)(unsigned long offset, unsigned long size, void *arg);
+
+long elf_func_symbols(int fd, elf_symbol_func_t func, void *arg);
+
+typedef void (*elf_named_symbol_func_t)(const char *name, unsigned long offset,
+                                        unsigned long size, void *arg);
+
+long elf_named_func_symbols(int fd, elf_named_symbol_func_t func, void *arg);
+
+void load_func_symbols(int fd, unsigned long long inode, unsigned long long dev,
+                               unsigned long mtime);
+
+int find_func_symbol(unsigned long long inode, unsigned long long dev,
+                     unsigned long mtime, unsigned long offset,
+                     unsigned long *start, unsigned long *size);
+
+#endif /* ELF_SYMBOLS_H */
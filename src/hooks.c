@@ -22,12 +22,14 @@
 
 #include "hooks.h"
 #include "taint.h"
+#include "taint_summary.h"
 #include "opcodes.h"
 #include "lib.h"
 #include "mm.h"
 #include "error.h"
 #include "taint_dump.h"
 #include "syscalls.h"
+#include "threads.h"
 
 static struct
 {
@@ -137,14 +139,36 @@ int parse_hooklist(char *s)
 hook_t hook_table[MAX_HOOKS];
 
 int n_hooks = 0;
+static long hook_lock = 0;
 
 int register_hook(hook_func_t func, unsigned long long inode,
                                     unsigned long long dev,
                                     unsigned long mtime,
                                     unsigned long long offset)
 {
+	int i;
+
+	mutex_lock(&hook_lock);
+
+	/* hooks get registered again for every process mapping the file */
+	for (i=0; i<n_hooks; i++)
+		if ( (hook_table[i].inode  == inode) &&
+		     (hook_table[i].dev    == dev)   &&
+		     (hook_table[i].mtime  == mtime) &&
+		     (hook_table[i].offset == offset) )
+			break;
+
+	if (i < n_hooks)
+	{
+		mutex_unlock(&hook_lock);
+		return 0;
+	}
+
 	if (n_hooks >= MAX_HOOKS)
+	{
+		mutex_unlock(&hook_lock);
 		return -1;
+	}
 
 	hook_table[n_hooks] = (hook_t)
 	{
@@ -157,6 +181,7 @@ int register_hook(hook_func_t func, unsigned long long inode,
 
 	n_hooks++;
 
+	mutex_unlock(&hook_lock);
 	return 0;
 }
 
@@ -178,9 +203,10 @@ hook_func_t get_hook_func(code_map_t *map, unsigned long offset)
 
 void dump_string_if_tainted(char *msg, char *s, int len)
 {
-	int i, taint=0;
+	unsigned char taint_buf[256];
+	int i, n, taint=0;
 	for (i=0; i<len; i++)
-		taint |= s[TAINT_OFFSET+i];
+		taint |= get_mem_taint(&s[i]);
 
 	if (!taint)
 		return;
@@ -191,7 +217,12 @@ void dump_string_if_tainted(char *msg, char *s, int len)
 		return;
 
 	fd_printf(fd, "Warning: %s: ", msg);
-	stringdump_taint(fd, s, len, (const unsigned char *)s+TAINT_OFFSET);
+	for (i=0; i<len; i+=n)
+	{
+		n = (len-i < (int)sizeof(taint_buf)) ? len-i : (int)sizeof(taint_buf);
+		get_taint_bytes(taint_buf, &s[i], n);
+		stringdump_taint(fd, &s[i], n, taint_buf);
+	}
 	fd_printf(fd, "\n");
 	sys_close(fd);
 }
@@ -237,6 +268,8 @@ int dump_regs(long *regs)
 int install_return_hook(long *regs, unsigned type)
 {
 	unsigned long esp = regs[4];
+
+	taint_summary_mark((void *)esp, sizeof(long));
 	*(unsigned long *)(esp+TAINT_OFFSET) |= type;
 }
 
@@ -37,9 +37,16 @@
 #include "jit_cache.h"
 #include "threads.h"
 #include "hooks.h"
+#include "jit_spec.h"
+#include "elf_symbols.h"
+#include "taint.h"
+#include "sigwrap.h"
 
 long jit_lock = 0;
 
+int jit_whole_func = 0;
+unsigned long jit_func_window = 0;
+
 #define TRANSLATED_MAX_SIZE (255)
 
 unsigned long min(unsigned long a, unsigned long b) { return a<b ? a:b; }
@@ -55,6 +62,11 @@ unsigned long min(unsigned long a, unsigned long b) { return a<b ? a:b; }
  *
  * sizeof(jit_chunk_t) JIT code
  *
+ * hdr.cold_off        Cold code:
+ *                     out-of-line stubs for rarely taken paths (cross-map
+ *                     conditional jumps, hooks.) The hot code jumps here
+ *                     with a rel32, keeping the straight-line path dense.
+ *
  * hdr.lookup_off      Stage 1 lookup:
  *                     (64 byte aligned) course grained lookup table for
  *                     mapping original code addresses to jit code. For every
@@ -76,6 +88,10 @@ unsigned long min(unsigned long a, unsigned long b) { return a<b ? a:b; }
  *                     offset for the instuction at the start of the frame
  *                     was actually x bytes before the start of the frame.
  *
+ * hdr.cold_tbl_off    Cold code lookup:
+ *                     (original offset, jit size) for every cold stub, in
+ *                     the same order as the stubs, for reverse lookups.
+ *
  * -----------------------
  * hdr.chunk_len       next chunk (64 byte aligned)
  * ....
@@ -91,10 +107,27 @@ typedef struct
 {
 	char *addr; unsigned long len;
 	unsigned long chunk_len, lookup_off, tbl_off, n_ops;
+	unsigned long cold_off, cold_tbl_off, n_cold;
 	int tree_depth;
 
 } jit_chunk_t;
 
+typedef struct
+{
+	unsigned long s_off, len;
+
+} cold_op_t;
+
+/* cold stub, pending until the hot code of a chunk has been generated */
+typedef struct
+{
+	char *addr;       /* jump destination, or hooked instruction */
+	hook_func_t func; /* NULL for cross-map jumps */
+	unsigned long s_off, imm_off, ret_off, len;
+	int backedge;     /* taint live / signal check in front of a backward jump */
+
+} cold_stub_t;
+
 
 /* a */
 typedef struct
@@ -110,6 +143,16 @@ typedef struct
 
 } rel_jmp_t;
 
+/* extra entry points to translate in the same batch (jump table targets) */
+#define MAX_EXTRA_ENTRIES (4096)
+
+typedef struct
+{
+	char *addr[MAX_EXTRA_ENTRIES];
+	unsigned long n;
+
+} entry_list_t;
+
 /* Small min-heap implementation for relative jumps
  *
  * adding an element to the heap -> log n
@@ -227,6 +270,7 @@ typedef struct
 #define DIV_CEIL(x, d) ( ( (long)(x)+(long)(d)-1)/(long)(d) )
 
 static void jit_chunk_create_lookup_mapping(jit_chunk_t *hdr, size_pair_t *sizes,
+                                            cold_stub_t *cold,
                                             char *base, unsigned long max_len)
 {
 	long n_frames = DIV_CEIL(hdr->len, FRAME_SIZE);
@@ -263,7 +307,16 @@ static void jit_chunk_create_lookup_mapping(jit_chunk_t *hdr, size_pair_t *sizes
 		d_off   += sizes[i].jit;
 	}
 
-	hdr->chunk_len = CHUNK_OFFSET(ALIGN(&table[j], 64));
+	cold_op_t *cold_tbl = (cold_op_t *)ALIGN(&table[j], sizeof(long));
+	hdr->cold_tbl_off = CHUNK_OFFSET(cold_tbl);
+
+	if ((unsigned long)&cold_tbl[hdr->n_cold] > (unsigned long)&base[max_len])
+		die("out of JIT memory");
+
+	for (i=0; i < hdr->n_cold; i++)
+		cold_tbl[i] = (cold_op_t) { .s_off = cold[i].s_off, .len = cold[i].len };
+
+	hdr->chunk_len = CHUNK_OFFSET(ALIGN(&cold_tbl[i], 64));
 }
 
 #undef ALIGN
@@ -346,9 +399,34 @@ char *jit_lookup_addr(char *addr)
 
 /* reverse address lookup */
 
+static char *jit_chunk_rev_lookup_cold(jit_chunk_t *hdr, char *jit_addr, char **jit_op_start, long *jit_op_len)
+{
+	cold_op_t *cold_tbl = (cold_op_t *)((long)hdr+hdr->cold_tbl_off);
+	unsigned long in_d_off = CHUNK_OFFSET(jit_addr), d_off = hdr->cold_off, i;
+
+	for (i=0; i<hdr->n_cold; i++)
+	{
+		if ( in_d_off < d_off+cold_tbl[i].len )
+		{
+			if (jit_op_start)
+				*jit_op_start = &((char *)hdr)[d_off];
+			if (jit_op_len)
+				*jit_op_len = cold_tbl[i].len;
+
+			return &hdr->addr[cold_tbl[i].s_off];
+		}
+		d_off += cold_tbl[i].len;
+	}
+
+	return NULL;
+}
+
 static char *jit_chunk_rev_lookup_addr(jit_chunk_t *hdr, char *jit_addr, char **jit_op_start, long *jit_op_len)
 {
-	if (!contains((char *)hdr, hdr->lookup_off, jit_addr))
+	if (contains((char *)hdr+hdr->cold_off, hdr->lookup_off-hdr->cold_off, jit_addr))
+		return jit_chunk_rev_lookup_cold(hdr, jit_addr, jit_op_start, jit_op_len);
+
+	if (!contains((char *)hdr, hdr->cold_off, jit_addr))
 		return NULL;
 
 	long n_frames = DIV_CEIL(hdr->len, FRAME_SIZE), mid;
@@ -423,7 +501,16 @@ static char *jit_map_rev_lookup_addr(code_map_t *map, char *jit_addr, char **jit
 
 char *jit_rev_lookup_addr(char *jit_addr, char **jit_op_start, long *jit_op_len)
 {
-	code_map_t *map = find_jit_code_map(jit_addr);
+	code_map_t *map = find_jit_code_map(jit_addr), bare;
+
+	if (map && !contains(map->jit_addr, map->jit_len, jit_addr))
+	{
+		/* retired bare code */
+		bare = *map;
+		bare.jit_addr = bare.bare_jit_addr;
+		bare.jit_len = bare.bare_jit_len;
+		map = &bare;
+	}
 
 	if (map)
 		return jit_map_rev_lookup_addr(map, jit_addr, jit_op_start, jit_op_len);
@@ -497,24 +584,126 @@ static int try_resolve_jmp(code_map_t *map, char *jmp_addr, char *imm_addr,
 		return 0;
 }
 
+/* Generates the out-of-line stubs collected during the translation of
+ * a chunk's hot code at d_off, and points the hot code's jumps to them
+ */
+static unsigned long jit_translate_cold(code_map_t *map, unsigned long d_off,
+                                        cold_stub_t *cold, unsigned long n_cold,
+                                        jmp_heap_t *jmp_heap, unsigned long *mapping)
+{
+	char *jit_addr=map->jit_addr, *stub, *imm_addr;
+	unsigned long max_len = jit_mem_size(jit_addr), i;
+	trans_t trans;
+	rel_jmp_t jmp;
+
+	for (i=0; i<n_cold; i++)
+	{
+		if ( d_off+TRANSLATED_MAX_SIZE > max_len )
+			die("out of JIT memory");
+
+		stub = &jit_addr[d_off];
+		imm_addr = &jit_addr[cold[i].imm_off];
+
+		if (cold[i].func)
+			cold[i].len = generate_hook(stub, cold[i].addr, cold[i].func,
+			                            &jit_addr[cold[i].ret_off]);
+		else if (cold[i].backedge)
+		{
+			cold[i].len = generate_backedge_check(stub, cold[i].addr, &trans);
+
+			if (!try_resolve_jmp(map, trans.jmp_addr, &stub[trans.imm], mapping))
+			{
+				jmp = (rel_jmp_t){ .addr=trans.jmp_addr, .off=d_off+trans.imm };
+				heap_put(jmp_heap, &jmp);
+			}
+		}
+		else
+			cold[i].len = generate_cross_map_jump(stub, cold[i].addr, &trans);
+
+		imm_to(imm_addr, (long)stub - (long)imm_addr - 4);
+		d_off += cold[i].len;
+	}
+
+	return d_off;
+}
+
+#define MAX_COLD_STUBS (64)
+
+#define MAX_JUMP_TABLE (1024)
+
+/* record the targets of a jump table as extra entry points, as long as they
+ * point into this map. The table itself may live in any readable mapping,
+ * with -z separate-code .rodata has a segment of its own
+ * prev holds the three instructions before instr
+ */
+static void jit_record_jump_table(code_map_t *map, instr_t *instr, instr_t *prev,
+                                  entry_list_t *extra)
+{
+	int kind;
+	char *table = jump_table_addr(instr, prev, &kind), *target;
+	unsigned long i, val, size = (kind == JUMP_TABLE_ABS64) ? 8 : 4;
+
+	if (table == NULL)
+		return;
+
+	for (i=0; i<MAX_JUMP_TABLE && extra->n < MAX_EXTRA_ENTRIES; i++)
+	{
+		if ( !user_readable((unsigned long)&table[i*size], size) )
+			break;
+
+		val = imm_at(&table[i*size], size);
+
+		if (kind == JUMP_TABLE_REL32)
+			target = table + (int)val;
+		else if (kind == JUMP_TABLE_ABS32)
+			target = (char *)(val & 0xffffffffL);
+		else
+			target = (char *)val;
+
+		if (!contains(map->addr, map->len, target))
+			break;
+
+		extra->addr[extra->n++] = target;
+	}
+}
+
+/* how many bytes from s_off on could be translated as one instruction
+ * (a run of single byte push/pop instructions, or mov $NR, %eax ; syscall,)
+ * none of them but the first may be an entry point or a hook
+ */
+static long stack_run_room(code_map_t *map, unsigned long *mapping, unsigned long s_off)
+{
+	long n = 1;
+
+	while ( (n < MAX_STACK_RUN) && (s_off+n < map->len) &&
+	        !TRANSLATED(mapping[s_off+n]) && (mapping[s_off+n] != HOOK) )
+		n++;
+
+	return n;
+}
+
 /* Translate a chunk of chunk of code
  *
  */
 static jit_chunk_t *jit_translate_chunk(code_map_t *map, char *entry_addr, unsigned long chunk_base,
-                                        jmp_heap_t *jmp_heap, unsigned long *mapping)
+                                        jmp_heap_t *jmp_heap, unsigned long *mapping,
+                                        entry_list_t *extra)
 {
 	char *jit_addr=map->jit_addr, *addr=map->addr;
-	unsigned long n_ops = 0,
+	unsigned long n_ops = 0, n_cold = 0,
 	              entry = entry_addr-addr,
 	              s_off = entry_addr-addr,
 	              d_off = chunk_base+sizeof(jit_chunk_t),
+	              cold_off,
 	              max_len = jit_mem_size(jit_addr);
 	int stop = 0, is_hook, hook_size=0;
+	long room;
 
-	instr_t instr;
+	instr_t instr, prev[3] = { { 0 } };
 	trans_t trans;
 	rel_jmp_t jmp;
 	size_pair_t sizes[map->len];
+	cold_stub_t cold[MAX_COLD_STUBS];
 
 	while (stop == 0)
 	{
@@ -526,16 +715,64 @@ static jit_chunk_t *jit_translate_chunk(code_map_t *map, char *entry_addr, unsig
 		mapping[s_off] = d_off;
 
 		if (is_hook)
-			d_off += hook_size = generate_hook(&jit_addr[d_off], &addr[s_off],
-			                                   get_hook_func(map, s_off));
+		{
+			/* jmp to the hook in the cold section, which returns here */
+			d_off += hook_size = jump_to(&jit_addr[d_off], &jit_addr[d_off]);
+			cold[n_cold++] = (cold_stub_t)
+			{
+				.addr = &addr[s_off],
+				.func = get_hook_func(map, s_off),
+				.s_off = s_off-entry,
+				.imm_off = d_off-4,
+				.ret_off = d_off,
+			};
+		}
 
 		stop = read_op(&addr[s_off], &instr, map->len-s_off);
-		translate_op(&jit_addr[d_off], &instr, &trans, map->addr, map->len);
+		room = stack_run_room(map, mapping, s_off);
+		if ( !generate_stack_run(&jit_addr[d_off], &instr, &trans, room) &&
+		     !generate_syscall_direct(&jit_addr[d_off], &instr, &trans, room,
+		                              map->addr, map->len) )
+			translate_op(&jit_addr[d_off], &instr, &trans, map->addr, map->len);
 
+		if (extra)
+		{
+			jit_record_jump_table(map, &instr, prev, extra);
+			prev[2] = prev[1];
+			prev[1] = prev[0];
+			prev[0] = instr;
+		}
+
+		if ( trans.cold || ((trans.imm == 0) && trans.jmp_addr) )
+			jit_spec_queue(trans.jmp_addr); /* jump into another map */
+
+		if (trans.cold)
+		{
+			cold[n_cold++] = (cold_stub_t)
+			{
+				.addr = trans.jmp_addr,
+				.s_off = s_off-entry,
+				.imm_off = d_off+trans.imm,
+			};
+		}
+		else if ( ((taint_flag == TAINT_CLEAN) || lazy_signals) && (trans.imm != 0) &&
+		          (trans.jmp_addr <= &addr[s_off]) )
+		{
+			/* backward jump in bare code, check whether taint went live,
+			 * or with -lazysignals, whether a signal is waiting
+			 */
+			cold[n_cold++] = (cold_stub_t)
+			{
+				.addr = trans.jmp_addr,
+				.s_off = s_off-entry,
+				.imm_off = d_off+trans.imm,
+				.backedge = 1,
+			};
+		}
 		/* try to resolve translated jumps early */
-		if ( (trans.imm != 0) && !try_resolve_jmp(map, trans.jmp_addr,
-		                                          &jit_addr[d_off+trans.imm],
-		                                          mapping) )
+		else if ( (trans.imm != 0) && !try_resolve_jmp(map, trans.jmp_addr,
+		                                               &jit_addr[d_off+trans.imm],
+		                                               mapping) )
 		{
 			/* destination address not translated yet */
 			jmp = (rel_jmp_t){ .addr=trans.jmp_addr, .off=d_off+trans.imm };
@@ -564,10 +801,28 @@ static jit_chunk_t *jit_translate_chunk(code_map_t *map, char *entry_addr, unsig
 
 			d_off += trans.len;
 		}
+		else if ( (stop == 0) && (n_cold >= MAX_COLD_STUBS-1) )
+		{
+			/* no room for more cold stubs, continue in a new chunk */
+			stop = 1;
+			generate_jump(&jit_addr[d_off], &addr[s_off], &trans,
+			              map->addr, map->len);
+
+			if (trans.imm != 0)
+			{
+				jmp = (rel_jmp_t){ .addr=trans.jmp_addr, .off=d_off+trans.imm };
+				heap_put(jmp_heap, &jmp);
+			}
+
+			d_off += trans.len;
+		}
 
 		n_ops++;
 	}
 
+	cold_off = d_off;
+	d_off = jit_translate_cold(map, d_off, cold, n_cold, jmp_heap, mapping);
+
 	jit_chunk_t *hdr = (jit_chunk_t*)&jit_addr[chunk_base];
 	*hdr = (jit_chunk_t)
 	{
@@ -575,9 +830,11 @@ static jit_chunk_t *jit_translate_chunk(code_map_t *map, char *entry_addr, unsig
 		.len = s_off-entry,
 		.chunk_len = d_off-chunk_base, /* to be extended during lookup map creation */
 		.n_ops = n_ops,
+		.cold_off = cold_off-chunk_base,
+		.n_cold = n_cold,
 	};
 
-	jit_chunk_create_lookup_mapping(hdr, sizes, jit_addr, max_len);
+	jit_chunk_create_lookup_mapping(hdr, sizes, cold, jit_addr, max_len);
 
 	return hdr;
 }
@@ -595,23 +852,113 @@ void jit_resize(code_map_t *map, unsigned long cur_size)
 	commit();
 }
 
+/* Translates all code reachable through relative jumps from entry_addr
+ * and returns the new end of the jit code
+ */
+static unsigned long jit_translate_reachable(code_map_t *map, char *entry_addr,
+                                             unsigned long chunk_base,
+                                             jmp_heap_t *jmp_heap, unsigned long *mapping,
+                                             entry_list_t *extra)
+{
+	jit_chunk_t *hdr;
+	rel_jmp_t j;
+
+	if ( TRANSLATED(mapping[entry_addr-map->addr]) )
+		return chunk_base;
+
+	hdr = jit_translate_chunk(map, entry_addr, chunk_base, jmp_heap, mapping, extra);
+	chunk_base += hdr->chunk_len;
+
+	while (heap_get(jmp_heap, &j))
+		while (!try_resolve_jmp(map, j.addr, &map->jit_addr[j.off], mapping))
+		{
+			hdr = jit_translate_chunk(map, j.addr, chunk_base, jmp_heap, mapping, extra);
+			chunk_base += hdr->chunk_len;
+		}
+
+	return chunk_base;
+}
+
+/* Finds the extent of the function containing addr, using the symbol
+ * table of the mapped file, or a window of jit_func_window bytes.
+ */
+static int jit_func_extent(code_map_t *map, char *addr, unsigned long *start,
+                                                        unsigned long *end)
+{
+	unsigned long off = addr-map->addr,
+	              file_off = map->pgoffset*PG_SIZE + off,
+	              sym_start, sym_size;
+
+	if ( map->inode && find_func_symbol(map->inode, map->dev, map->mtime,
+	                                    file_off, &sym_start, &sym_size) )
+	{
+		*start = off - (file_off-sym_start);
+		*end = *start + sym_size;
+
+		if ( *start > off ) /* function starts before this map */
+			*start = off;
+	}
+	else if (jit_func_window)
+	{
+		*start = off;
+		*end = off + jit_func_window;
+	}
+	else
+		return 0;
+
+	if (*end > map->len)
+		*end = map->len;
+
+	return 1;
+}
+
+/* Translates the function containing entry_addr from start to end, by
+ * sweeping over its instructions and translating whatever has not been
+ * reached yet.
+ */
+static unsigned long jit_translate_function(code_map_t *map, char *entry_addr,
+                                            unsigned long chunk_base,
+                                            jmp_heap_t *jmp_heap, unsigned long *mapping,
+                                            entry_list_t *extra)
+{
+	unsigned long off, end;
+	instr_t instr;
+
+	if (!jit_func_extent(map, entry_addr, &off, &end))
+		return chunk_base;
+
+	while (off < end)
+	{
+		chunk_base = jit_translate_reachable(map, &map->addr[off], chunk_base,
+		                                     jmp_heap, mapping, extra);
+		read_op(&map->addr[off], &instr, map->len-off);
+		if (instr.len == 0)
+			break;
+		off += instr.len;
+	}
+
+	return chunk_base;
+}
+
 /* Translates all reachable code from map starting from entry_addr
  *
+ * With jit_whole_func set, the rest of the function and the targets of
+ * jump tables are translated in the same batch, so that fewer rounds of
+ * mprotect() calls and mapping rebuilds are needed during warm-up.
  */
 static void jit_translate(code_map_t *map, char *entry_addr)
 {
 	jmp_heap_t jmp_heap;
-	rel_jmp_t j;
 	rel_jmp_t jumps[map->len/4]; /* mostly unused */
 	unsigned long mapping[map->len+1]; /* waste of memory :-( */
 	unsigned long chunk_base = map->jit_len;
-	jit_chunk_t *hdr;
+	entry_list_t extra_buf, *extra = NULL;
 
 	heap_init(&jmp_heap, jumps, map->len/4);
 
 	jit_fill_mapping(map, mapping, map->len+1);
 
-	unsigned long base_off = PAGE_BASE(map->jit_len);
+	unsigned long base_off = jit_mem_prot_base(map->jit_len);
 	char *base = &map->jit_addr[base_off];
 
 	sys_mprotect(base, jit_mem_size(map->jit_addr)-base_off,
@@ -619,15 +966,27 @@ static void jit_translate(code_map_t *map, char *entry_addr)
 
 	jit_mem_balloon(map->jit_addr);
 
-	hdr = jit_translate_chunk(map, entry_addr, chunk_base, &jmp_heap, mapping);
-	chunk_base += hdr->chunk_len;
+	if (jit_whole_func)
+	{
+		extra = &extra_buf;
+		extra->n = 0;
+	}
 
-	while (heap_get(&jmp_heap, &j))
-		while (!try_resolve_jmp(map, j.addr, &map->jit_addr[j.off], mapping))
+	chunk_base = jit_translate_reachable(map, entry_addr, chunk_base,
+	                                     &jmp_heap, mapping, extra);
+
+	if (jit_whole_func)
+	{
+		chunk_base = jit_translate_function(map, entry_addr, chunk_base,
+		                                    &jmp_heap, mapping, extra);
+
+		while (extra->n > 0)
 		{
-			hdr = jit_translate_chunk(map, j.addr, chunk_base, &jmp_heap, mapping);
-			chunk_base += hdr->chunk_len;
+			extra->n--;
+			chunk_base = jit_translate_reachable(map, extra->addr[extra->n], chunk_base,
+			                                     &jmp_heap, mapping, extra);
 		}
+	}
 
 	jit_resize(map, chunk_base);
 
@@ -640,6 +999,15 @@ void jit_init(void)
 	jit_mem_init();
 }
 
+static void jit_map_init(code_map_t *map)
+{
+	if (map->jit_addr == NULL)
+	{
+		map->jit_addr = jit_mem_balloon(NULL);
+		try_load_jit_cache(map);
+	}
+}
+
 char *jit(char *addr)
 {
 	char *jit_addr = find_jmp_mapping(addr);
@@ -656,11 +1024,7 @@ char *jit(char *addr)
 		return NULL;
 	}
 
-	if (map->jit_addr == NULL)
-	{
-		map->jit_addr = jit_mem_balloon(NULL);
-		try_load_jit_cache(map);
-	}
+	jit_map_init(map);
 
 	jit_addr = jit_lookup_addr(addr);
 
@@ -677,3 +1041,44 @@ char *jit(char *addr)
 	return jit_addr;
 }
 
+/* Code maps are removed under the same jit_lock as the call which unmaps
+ * their memory, and their memory is always readable, see no_exec() in mm.c.  This also
+ * asks the kernel whether all of it is still mapped, should some other way
+ * of unmapping memory slip past mm.c.  A fault in the helper thread would
+ * take down the whole process.
+ */
+static int code_map_present(code_map_t *map)
+{
+	static unsigned char vec[PG_SIZE]; /* jit_lock */
+	unsigned long off, n;
+
+	for (off=0; off < map->len; off += n)
+	{
+		n = min(map->len-off, sizeof(vec)*PG_SIZE);
+
+		if ( sys_mincore(map->addr+off, n, vec) < 0 )
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Translates addr if it has not been translated yet, without touching
+ * the jump cache.  Used by the speculative translation thread, with
+ * jit_lock held, on the jit stack.
+ */
+void jit_translate_ahead(char *addr)
+{
+	code_map_t *map = find_code_map(addr);
+
+	if ( (map == NULL) || !code_map_present(map) )
+		return;
+
+	jit_map_init(map);
+
+	if (jit_map_lookup_addr(map, addr) == NULL)
+	{
+		jit_translate(map, addr);
+		try_save_jit_cache(map);
+	}
+}
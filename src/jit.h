@@ -23,10 +23,13 @@
 #include "codemap.h"
 
 extern long jit_lock;
+extern int jit_whole_func;
+extern unsigned long jit_func_window;
 
 void jit_init(void);
 void jit_resize(code_map_t *map, unsigned long cur_size);
 char *jit(char *addr);
+void jit_translate_ahead(char *addr);
 char *jit_lookup_addr(char *addr);
 char *jit_rev_lookup_addr(char *jit_addr, char **jit_op_start, long *jit_op_len);
 
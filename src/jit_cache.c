@@ -28,10 +28,12 @@
 #include "syscalls.h"
 #include "error.h"
 #include "jit_code.h"
+#include "taint_code.h"
 #include "jit_mm.h"
 #include "jit.h"
 #include "taint.h"
 #include "kernel_compat.h"
+#include "sigwrap.h"
 
 static char cache_dir_buf[PATH_MAX+1] = { 0, };
 
@@ -76,6 +78,14 @@ static char *get_cache_filename(char *buf, code_map_t *map, int pid)
 
 	if ( taint_flag == TAINT_OFF )
 		strcat(buf, "N");
+	else if ( taint_flag == TAINT_CLEAN )
+		strcat(buf, "D");
+
+	if ( taint_vex )
+		strcat(buf, "V");
+
+	if ( lazy_signals )
+		strcat(buf, "B"); /* back edge checks */
 
 	if (pid > 0)
 	{
@@ -25,10 +25,13 @@
 #include "runtime.h"
 #include "error.h"
 #include "taint_code.h"
+#include "taint_sse.h"
 #include "taint.h"
 #include "debug.h"
 #include "mm.h"
 #include "threads.h"
+#include "syscalls.h"
+#include "jit_templates.h"
 
 int call_strategy = PRESEED_ON_CALL;
 
@@ -259,7 +262,7 @@ union
 #define CPUI CPUID
 #define XXX (C) /* todo */
 #define PRIV (C)
-#define MM (U)
+#define MM (SSE)
 
 #define TOMR ( TAINT | TAINT_OR_MEM_TO_REG           )
 #define TORM ( TAINT | TAINT_OR_REG_TO_MEM           )
@@ -319,7 +322,7 @@ const unsigned char jit_action[] =
 /* 3? */ BXRM,TXRM,BXMR,TXMR,  C ,  C , BAD,  C ,  C ,  C ,  C ,  C ,  C ,  C , BAD,  C ,
 /* 4? */   C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,  C ,
 /* 5? */ TCRP,TCRP,TCRP,TCRP,TCRP,TCRP,TCRP,TCRP,TCPR,TCPR,TCPR,TCPR,TCPR,TCPR,TCPR,TCPR,
-/* 6? */ TPUA,TPPA,  C ,PRIV, BAD, BAD, BAD, BAD, TEP,TCMR, TEP,TCMR,PRIV,PRIV,PRIV,PRIV,
+/* 6? */ TPUA,TPPA,  C ,TCMR, BAD, BAD, BAD, BAD, TEP,TCMR, TEP,TCMR,PRIV,PRIV,PRIV,PRIV,
 /* 7? */  JC , JC , JC , JC , JC , JC , JC , JC , JC , JC , JC , JC , JC , JC , JC , JC ,
 /* 8? */   C ,  C ,  C ,  C ,  C ,  C ,BSRM,TSRM,BCRM,TCRM,BCMR,TCMR, TEM,TLEA,  C ,TCPM,
 /* 9? */   C ,TSAR,TSAR,TSAR,TSAR,TSAR,TSAR,TSAR, TEH, TED,  CF,  C , TEP,  C ,  C , BEA,
@@ -366,7 +369,7 @@ const unsigned char jit_action[] =
 /* C? */  MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM,
 /* D? */  MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM,
 /* E? */  MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM,
-/* F? */  MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM,
+/* F? */   U,  U, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM, MM,
 
 	[G3A_OPTABLE] =
 /*        ?0  ?1  ?2  ?3  ?4  ?5  ?6  ?7  ?8  ?9  ?A  ?B  ?C  ?D  ?E  ?F */
@@ -527,54 +530,65 @@ int jump_to(char *dest, char *jmp_addr)
 	return 5;
 }
 
-int generate_hook(char *dest, char *addr, hook_func_t func)
+/* instantiate a template from jit_templates.h, the caller fills in the fields */
+#define TEMPLATE(dest, tpl) ( memcpy((dest), (tpl), sizeof(tpl)), (int)sizeof(tpl) )
+
+static void field_l(char *dest, long imm)
 {
-	int imm_index;
-	int len = gen_code(
-		dest,
-
-		"64 C7 05 L L"               /* movl func, hook */
-		"64 C7 05 L L"               /* movl addr, user_eip */
-		"64 C7 05 L & DEADBEEF",     /* movl &dest[len], jit_eip */
-
-		offsetof(thread_ctx_t, hook_func), func,
-		offsetof(thread_ctx_t, user_rip), addr,
-		offsetof(thread_ctx_t, jit_rip), &imm_index
-	);
-
-	/* jump into runtime code */
-	len += jump_to(&dest[len], (void *)(long)hook_stub);
-	imm_to(&dest[imm_index], (long)dest+len);
-	return len;
+	int l = imm;
+	memcpy(dest, &l, 4);
 }
 
-static int generate_linux_sysenter(char *dest, trans_t *trans)
+static void field_s(char *dest, long imm)
 {
-	int len = gen_code(
-		dest,
+	short s = imm;
+	memcpy(dest, &s, 2);
+}
 
-		"66 0f ef ed"    /* clear ijmp taint register (pxor %xmm5,%xmm5 */
-	);
+static void field_rel(char *dest, void *target)
+{
+	field_l(dest, (long)target - (long)&dest[4]);
+}
 
-	/* jump into runtime code */
-	len += jump_to(&dest[len], (void *)(long)linux_sysenter_emu);
-	*trans = (trans_t){ .len=len };
+int generate_hook(char *dest, char *addr, hook_func_t func, char *jit_ret)
+{
+	int len = TEMPLATE(dest, tpl_hook);
+	field_l(&dest[TPL_HOOK_FUNC_OFF], offsetof(thread_ctx_t, hook_func));
+	field_l(&dest[TPL_HOOK_FUNC], (long)func);
+	field_l(&dest[TPL_HOOK_RIP_OFF], offsetof(thread_ctx_t, user_rip));
+	field_l(&dest[TPL_HOOK_ADDR], (long)addr);
+	field_l(&dest[TPL_HOOK_JIT_OFF], offsetof(thread_ctx_t, jit_rip));
+	field_l(&dest[TPL_HOOK_JIT], (long)jit_ret);
+	field_rel(&dest[TPL_HOOK_STUB], (void *)(long)hook_stub);
 	return len;
 }
 
-static int generate_linux_syscall(char *dest, instr_t *instr, trans_t *trans)
+static int generate_linux_sysenter(char *dest, trans_t *trans)
 {
-	int len = gen_code(
-		dest,
-
-		"66 0f ef ed"    /* clear ijmp taint register (pxor %xmm5,%xmm5 */
-		"64 48 C7 04 25 L L",     /* movq $post_addr, user_eip */
+	int len = TEMPLATE(dest, tpl_sysenter);
+	field_rel(&dest[TPL_SYSENTER_EMU], (void *)(long)linux_sysenter_emu);
+	*trans = (trans_t){ .len=len };
+	return len;
+}
 
-		offsetof(thread_ctx_t, user_rip), &instr->addr[instr->len]
-	);
+/* both the guest and the jit address of the next instruction are stored,
+ * calls which do not move the guest elsewhere return through jit_return
+ */
+static int generate_syscall_template(char *dest, char *post_addr, void *emu)
+{
+	int len = TEMPLATE(dest, tpl_syscall);
+	field_l(&dest[TPL_SYSCALL_RIP_OFF], offsetof(thread_ctx_t, user_rip));
+	field_l(&dest[TPL_SYSCALL_ADDR], (long)post_addr);
+	field_l(&dest[TPL_SYSCALL_JIT_OFF], offsetof(thread_ctx_t, jit_rip));
+	field_l(&dest[TPL_SYSCALL_JIT], (long)dest+len);
+	field_rel(&dest[TPL_SYSCALL_EMU], emu);
+	return len;
+}
 
-	/* jump into runtime code */
-	len += jump_to(&dest[len], (void *)(long)linux_syscall_emu);
+static int generate_linux_syscall(char *dest, instr_t *instr, trans_t *trans)
+{
+	int len = generate_syscall_template(dest, &instr->addr[instr->len],
+	                                    (void *)(long)linux_syscall_emu);
 	*trans = (trans_t){ .len=len };
 	return len;
 }
@@ -582,68 +596,130 @@ static int generate_linux_syscall(char *dest, instr_t *instr, trans_t *trans)
 static int generate_int80(char *dest, instr_t *instr, trans_t *trans)
 {
 	/* save origin, original address */
-	int len = gen_code(
-		dest,
+	int len = TEMPLATE(dest, tpl_int80);
+	field_l(&dest[TPL_INT80_RIP_OFF], offsetof(thread_ctx_t, user_rip));
+	field_l(&dest[TPL_INT80_ADDR], (long)&instr->addr[instr->len]);
+	field_rel(&dest[TPL_INT80_EMU], (void *)(long)int80_emu);
+	*trans = (trans_t){ .len=len };
+	return len;
+}
 
-		"66 0f ef ed"    /* clear ijmp taint register (pxor %xmm5,%xmm5 */
-		"64 C7 05 L L",     /* movl $post_addr, user_eip */
+/* Runs of push %reg (or pop %reg) share one taint update, one 16 byte
+ * shadow store or load for every two stack slots.  The run becomes a single
+ * translated instruction, so nothing can enter it halfway.  max_run limits
+ * the run to instructions which are not entry points.
+ *
+ * Returns 0 if instr does not start a run, instr->len covers the run otherwise.
+ */
+int generate_stack_run(char *dest, instr_t *instr, trans_t *trans, long max_run)
+{
+	unsigned char *addr = (unsigned char *)instr->addr;
+	int first = addr[0] & 0xf8, regs[MAX_STACK_RUN], n, len;
 
-		offsetof(thread_ctx_t, user_rip), &instr->addr[instr->len]
-	);
+	if ( (taint_flag != TAINT_ON) || (instr->len != 1) || ( (first != 0x50) && (first != 0x58) ) )
+		return 0;
 
-	/* jump into runtime code */
-	len += jump_to(&dest[len], (void *)(long)int80_emu);
-	*trans = (trans_t){ .len=len };
+	for (n=0; (n < max_run) && (n < MAX_STACK_RUN) && ( (addr[n] & 0xf8) == first ); n++)
+	{
+		if (addr[n] == 0x5c)
+			break; /* pop %esp */
+
+		regs[n] = addr[n] & 7;
+	}
+
+	if (n < 2)
+		return 0;
+
+	if (first == 0x50)
+		len = taint_copy_push_regs(dest, regs, n, TAINT_OFFSET);
+	else
+		len = taint_copy_pop_regs(dest, regs, n, TAINT_OFFSET);
+
+	memcpy(&dest[len], addr, n);
+	len += n;
+
+	instr->len = n;
+	*trans = (trans_t){ .len = len };
 	return len;
 }
 
-static int generate_cpuid(char *dest, instr_t *instr, trans_t *trans)
+/* mov $NR, %eax ; syscall, where syscall_emu() would only pass NR on to the
+ * kernel, becomes a single translated instruction which calls
+ * syscall_direct() and returns straight to the next instruction.  max_run
+ * as for generate_stack_run(), the syscall may not be an entry point.
+ *
+ * Returns 0 if instr does not start such a pair, instr->len covers both otherwise.
+ */
+int generate_syscall_direct(char *dest, instr_t *instr, trans_t *trans, long max_run,
+                            char *map, unsigned long map_len)
 {
-	/* save origin, jit_address */
-	int retaddr_index;
-	int len = gen_code(
-		dest,
+#ifdef __x86_64__
+	unsigned char *addr = (unsigned char *)instr->addr;
+	int len;
+
+	if ( (instr->len != 5) || (addr[0] != 0xB8) || (max_run < 7) ||
+	     (addr[5] != 0x0F) || (addr[6] != 0x05) )
+		return 0;
 
-		"64 C7 05 L &DEADBEEF",    /* movl $post_addr, jit_eip */
+	if ( syscall_class(imm_at(&instr->addr[1], 4)) != SYSCALL_PASS )
+		return 0;
 
-		offsetof(thread_ctx_t, jit_rip), &retaddr_index
-	);
+	translate_op(dest, instr, trans, map, map_len); /* the mov itself */
+	len = trans->len;
+	len += generate_syscall_template(&dest[len], &instr->addr[7],
+	                                 (void *)(long)linux_syscall_direct);
 
-	/* jump into runtime code */
-	len += jump_to(&dest[len], (void *)(long)cpuid_emu);
+	instr->len = 7;
+	*trans = (trans_t){ .len = len };
+	return len;
+#else
+	return 0;
+#endif
+}
+
+static int generate_cpuid(char *dest, instr_t *instr, trans_t *trans)
+{
+	/* save origin, jit_address */
+	int len = TEMPLATE(dest, tpl_cpuid);
+	field_l(&dest[TPL_CPUID_JIT_OFF], offsetof(thread_ctx_t, jit_rip));
+	field_l(&dest[TPL_CPUID_JIT], (long)dest+len);
+	field_rel(&dest[TPL_CPUID_EMU], (void *)(long)cpuid_emu);
 	*trans = (trans_t){ .len=len };
-	imm_to(&dest[retaddr_index], (long)dest+trans->len);
 	return len;
 }
 
-static int generate_ijump_tail(char *dest)
+/* mov ... ( -> %eax ), with the operand of the original indirect jump/call */
+static int generate_load_target(char *dest, instr_t *instr)
 {
-	return jump_to(dest, (char *)(long)runtime_ijmp);
+	long mrm_len = instr->len - instr->mrm;
+	int len = 0;
+
+	if (instr->p[2])
+		dest[len++] = instr->p[2];
+
+	dest[len++] = '\x8B';
+	memcpy(&dest[len], &instr->addr[instr->mrm], mrm_len);
+	dest[len] &= 0xC7; /* -> %eax */
+
+	return len+mrm_len;
 }
 
 static int generate_ijump(char *dest, instr_t *instr, trans_t *trans)
 {
-	long mrm_len = instr->len - instr->mrm;
-	int len_taint=0, i;
+	char *t;
+	int len;
 
 	if ( taint_flag == TAINT_ON )
-		len_taint = taint_ijmp(dest, instr->p[2], &instr->addr[instr->mrm], TAINT_OFFSET);
+		len = taint_ijmp(dest, instr->p[2], &instr->addr[instr->mrm], TAINT_OFFSET);
 	else
-		len_taint = gen_code(dest, "66 0f ef ed");
+		len = TEMPLATE(dest, tpl_clear_ijmp_taint);
 
-	int len = len_taint+gen_code(
-		&dest[len_taint],
+	len += TEMPLATE(&dest[len], tpl_xmm_save);
+	len += generate_load_target(&dest[len], instr);
 
-		"66 0F 3A 22 E1 00" /* pinsrd $0, %ecx, %xmm4       */
-		"66 0F 3A 22 D8 00" /* pinsrd $0, %eax, %xmm3       */
-		"? 8B &$"           /* mov ... ( -> %eax )          */
-		"66 0F 3A 16 E9 00",/* pextrd $0, %xmm5, %ecx       */
-
-		instr->p[2], &i, &instr->addr[instr->mrm], mrm_len
-	);
-
-	dest[len_taint+i] &= 0xC7; /* -> %eax */
-	len += generate_ijump_tail(&dest[len]);
+	t = &dest[len];
+	len += TEMPLATE(t, tpl_ijump_tail);
+	field_rel(&t[TPL_IJUMP_TAIL_RUNTIME_IJMP], (void *)(long)runtime_ijmp);
 	*trans = (trans_t){ .len = len };
 
 	return len;
@@ -653,51 +729,36 @@ static int generate_call(char *dest, char *jmp_addr,
                          instr_t *instr, trans_t *trans,
                          char *map, unsigned long map_len)
 {
-	int hash = HASH_INDEX(&instr->addr[instr->len]);
-	int len_taint=0, retaddr_index, len;
+	char *retaddr = &instr->addr[instr->len], *t;
+	int hash = HASH_INDEX(retaddr);
+	int len_taint=0, len;
 
 	if ( taint_flag == TAINT_ON )
 		len_taint = taint_erase_push32(dest, TAINT_OFFSET);
 
+	t = &dest[len_taint];
+
 	if ( call_strategy == PRESEED_ON_CALL )
 	{
 		/* As a speed optimisation, we insert the return address directly
 		 * into the cache, this makes relocating code more messy though :-(
 		 */
-		len = len_taint+gen_code(
-			&dest[len_taint],
-
-			"68 L"                   /* push $retaddr                                        */
-			"64 C7 05 L L"           /* movl $addr,     jmp_cache[HASH_INDEX(addr)].addr     */
-			"64 C7 05 L & DEADBEEF", /* movl $jit_addr, jmp_cache[HASH_INDEX(addr)].jit_addr */
-
-			&instr->addr[instr->len],
-			hash*8, CACHE_MANGLE(&instr->addr[instr->len]),
-			hash*8+4, &retaddr_index
-		);
-		retaddr_index += len_taint;
+		len = len_taint+TEMPLATE(t, tpl_call_preseed);
+		field_l(&t[TPL_CALL_PRESEED_RETADDR], (long)retaddr);
+		field_l(&t[TPL_CALL_PRESEED_ADDR_OFF], hash*8);
+		field_l(&t[TPL_CALL_PRESEED_ADDR], (long)CACHE_MANGLE(retaddr));
+		field_l(&t[TPL_CALL_PRESEED_JIT_OFF], hash*8+4);
 	}
 	else if ( call_strategy == PREFETCH_ON_CALL )
 	{
-		len = len_taint+gen_code(
-			&dest[len_taint],
-
-			"68 L"                /* push $retaddr                                        */
-			"64 0F 18 0D L",      /* prefetch jmp_cache[HASH_INDEX(addr)]                 */
-
-			&instr->addr[instr->len],
-			hash*4
-		);
+		len = len_taint+TEMPLATE(t, tpl_call_prefetch);
+		field_l(&t[TPL_CALL_PREFETCH_RETADDR], (long)retaddr);
+		field_l(&t[TPL_CALL_PREFETCH_CACHE_OFF], hash*4);
 	}
 	else
 	{
-		len = len_taint+gen_code(
-			&dest[len_taint],
-
-			"68 L",               /* push $retaddr                                        */
-
-			&instr->addr[instr->len]
-		);
+		len = len_taint+TEMPLATE(t, tpl_call_lazy);
+		field_l(&t[TPL_CALL_LAZY_RETADDR], (long)retaddr);
 	}
 
 	generate_jump(&dest[len], jmp_addr, trans, map, map_len);
@@ -706,16 +767,16 @@ static int generate_call(char *dest, char *jmp_addr,
 		trans->len += len;
 
 	if ( call_strategy == PRESEED_ON_CALL )
-		imm_to(&dest[retaddr_index], (long)dest+trans->len);
+		field_l(&t[TPL_CALL_PRESEED_JIT], (long)dest+trans->len);
 
 	return trans->len;
 }
 
 static int generate_icall(char *dest, instr_t *instr, trans_t *trans)
 {
-	int hash = HASH_INDEX(&instr->addr[instr->len]);
-	long mrm_len = instr->len - instr->mrm;
-	int len_taint=0, mrm, retaddr_index, len;
+	char *retaddr = &instr->addr[instr->len], *t;
+	int hash = HASH_INDEX(retaddr);
+	int len;
 
 	/* XXX FUGLY as a speed optimisation, we insert the return address
 	 * directly into the cache, this makes relocating code more messy.
@@ -723,68 +784,39 @@ static int generate_icall(char *dest, instr_t *instr, trans_t *trans)
 	 * change the address in-place
 	 */
 	if ( taint_flag == TAINT_ON )
-		len_taint = taint_icall(dest, instr->p[2], &instr->addr[instr->mrm], TAINT_OFFSET);
+		len = taint_icall(dest, instr->p[2], &instr->addr[instr->mrm], TAINT_OFFSET);
 	else
-		len_taint = gen_code(dest, "66 0f ef ed");
+		len = TEMPLATE(dest, tpl_clear_ijmp_taint);
+
+	len += TEMPLATE(&dest[len], tpl_xmm_save);
+	len += generate_load_target(&dest[len], instr);
+
+	t = &dest[len];
 
 	if ( call_strategy == PRESEED_ON_CALL )
 	{
-		len = len_taint+gen_code(
-			&dest[len_taint],
-
-			"66 0F 3A 22 E1 00"      /* pinsrd $0, %ecx, %xmm4       */
-			"66 0F 3A 22 D8 00"      /* pinsrd $0, %eax, %xmm3       */
-			"? 8B &$"                /* mov ... ( -> %eax )                                  */
-			"66 0F 3A 16 E9 00"      /* pextrd $0, %xmm5, %ecx       */
-			"68 L"                   /* push $retaddr                                        */
-			"64 C7 05 L L"           /* movl $addr,     jmp_cache[HASH_INDEX(addr)].addr     */
-			"64 C7 05 L & DEADBEEF", /* movl $jit_addr, jmp_cache[HASH_INDEX(addr)].jit_addr */
-
-			instr->p[2], &mrm, &instr->addr[instr->mrm], mrm_len,
-			&instr->addr[instr->len],
-			hash*8, CACHE_MANGLE(&instr->addr[instr->len]),
-			hash*8+4, &retaddr_index
-		);
+		len += TEMPLATE(t, tpl_icall_preseed);
+		field_l(&t[TPL_ICALL_PRESEED_RETADDR], (long)retaddr);
+		field_l(&t[TPL_ICALL_PRESEED_ADDR_OFF], hash*8);
+		field_l(&t[TPL_ICALL_PRESEED_ADDR], (long)CACHE_MANGLE(retaddr));
+		field_l(&t[TPL_ICALL_PRESEED_JIT_OFF], hash*8+4);
+		field_l(&t[TPL_ICALL_PRESEED_JIT], (long)dest+len);
+		field_rel(&t[TPL_ICALL_PRESEED_RUNTIME_IJMP], (void *)(long)runtime_ijmp);
 	}
 	else if ( call_strategy == PREFETCH_ON_CALL )
 	{
-		len = len_taint+gen_code(
-			&dest[len_taint],
-
-			"66 0F 3A 22 E1 00"   /* pinsrd $0, %ecx, %xmm4       */
-			"66 0F 3A 22 D8 00"   /* pinsrd $0, %eax, %xmm3       */
-			"? 8B &$"             /* mov ... ( -> %eax )                                  */
-			"66 0F 3A 16 E9 00"   /* pextrd $0, %xmm5, %ecx       */
-			"68 L"                /* push $retaddr                                        */
-			"64 0F 18 0D L",      /* prefetch jmp_cache[HASH_INDEX(addr)]                 */
-
-			instr->p[2], &mrm, &instr->addr[instr->mrm], mrm_len,
-			&instr->addr[instr->len],
-			hash*8
-		);
+		len += TEMPLATE(t, tpl_icall_prefetch);
+		field_l(&t[TPL_ICALL_PREFETCH_RETADDR], (long)retaddr);
+		field_l(&t[TPL_ICALL_PREFETCH_CACHE_OFF], hash*8);
+		field_rel(&t[TPL_ICALL_PREFETCH_RUNTIME_IJMP], (void *)(long)runtime_ijmp);
 	}
 	else
 	{
-		len = len_taint+gen_code(
-			&dest[len_taint],
-
-			"66 0F 3A 22 E1 00"   /* pinsrd $0, %ecx, %xmm4       */
-			"66 0F 3A 22 D8 00"   /* pinsrd $0, %eax, %xmm3       */
-			"? 8B &$"             /* mov ... ( -> %eax )                                  */
-			"66 0F 3A 16 E9 00"   /* pextrd $0, %xmm5, %ecx       */
-			"68 L",               /* push $retaddr                                        */
-
-			instr->p[2], &mrm, &instr->addr[instr->mrm], mrm_len,
-			&instr->addr[instr->len]
-		);
+		len += TEMPLATE(t, tpl_icall_lazy);
+		field_l(&t[TPL_ICALL_LAZY_RETADDR], (long)retaddr);
+		field_rel(&t[TPL_ICALL_LAZY_RUNTIME_IJMP], (void *)(long)runtime_ijmp);
 	}
 
-	dest[len_taint+mrm] &= 0xC7; /* -> %eax */
-	len += generate_ijump_tail(&dest[len]);
-
-	if ( call_strategy == PRESEED_ON_CALL )
-		imm_to(&dest[len_taint+retaddr_index], ((long)dest)+len);
-
 	*trans = (trans_t){ .len = len };
 	return len;
 }
@@ -798,38 +830,39 @@ static int generate_ret(char *dest, char *addr, trans_t *trans)
 
 static int generate_ret_cleanup(char *dest, char *addr, trans_t *trans)
 {
-	int len = gen_code(
-		dest,
-
-		"66 0F 3A 22 E1 00" /* pinsrd $0, %ecx, %xmm4       */
-		"66 0F 3A 22 D8 00" /* pinsrd $0, %eax, %xmm3       */
-		"8b 8C 24 L"        /* mov TAINT_OFFSET(%esp), %ecx */
-		"58"                /* pop %eax                     */
-		"8D A4 24 S 00 00", /* lea N(%esp),%esp             */
-
-		TAINT_OFFSET,
-		addr[1] + (addr[2]<<8)
-	);
-
-	len += generate_ijump_tail(&dest[len]);
+	int len = TEMPLATE(dest, tpl_ret_cleanup);
+	field_l(&dest[TPL_RET_CLEANUP_TAINT_OFF], TAINT_OFFSET);
+	field_s(&dest[TPL_RET_CLEANUP_N], addr[1] + (addr[2]<<8));
+	field_rel(&dest[TPL_RET_CLEANUP_RUNTIME_IJMP], (void *)(long)runtime_ijmp);
 	*trans = (trans_t){ .len=len };
 
 	return len;
 }
 
-static int generate_cross_map_jump(char *dest, char *jmp_addr, trans_t *trans)
+int generate_cross_map_jump(char *dest, char *jmp_addr, trans_t *trans)
 {
-	int len = gen_code(
-		dest,
-		"66 0F 3A 22 E1 00"   /* pinsrd $0, %ecx, %xmm4       */
-		"66 0F 3A 22 D8 00"   /* pinsrd $0, %eax, %xmm3       */
-		"B8 L"                /* mov jmp_addr, %eax           */
-		"B9 00 00 00 00",     /* mov $0x0,%ecx                */
-
-		jmp_addr
-	);
-	len += generate_ijump_tail(&dest[len]);
-	*trans = (trans_t){ .len=len };
+	int len = TEMPLATE(dest, tpl_cross_map_jump);
+	field_l(&dest[TPL_CROSS_MAP_JUMP_JMP_ADDR], (long)jmp_addr);
+	field_rel(&dest[TPL_CROSS_MAP_JUMP_RUNTIME_IJMP], (void *)(long)runtime_ijmp);
+	*trans = (trans_t){ .jmp_addr=jmp_addr, .len=len };
+	return len;
+}
+
+/* backward jumps in bare code (TAINT_CLEAN) go through this check, so that
+ * code which is still running when taint becomes live finds its way out to
+ * the instrumented translation.  With -lazysignals, backward jumps in other
+ * code check for a delayed signal the same way.  trans->imm is the offset of
+ * the rel32 to the translated jump target.
+ */
+int generate_backedge_check(char *dest, char *jmp_addr, trans_t *trans)
+{
+	int len = TEMPLATE(dest, tpl_backedge_check);
+	field_l(&dest[TPL_BACKEDGE_CHECK_LIVE_OFF], taint_flag == TAINT_CLEAN ?
+	                                            offsetof(thread_ctx_t, taint_live) :
+	                                            offsetof(thread_ctx_t, sig_pending));
+	field_l(&dest[TPL_BACKEDGE_CHECK_JMP_ADDR], (long)jmp_addr);
+	field_rel(&dest[TPL_BACKEDGE_CHECK_RUNTIME_IJMP], (void *)(long)runtime_ijmp);
+	*trans = (trans_t){ .jmp_addr=jmp_addr, .imm=TPL_BACKEDGE_CHECK_TARGET, .len=len };
 	return len;
 }
 
@@ -858,10 +891,12 @@ static int generate_jcc(char *dest, char *jmp_addr, int cond, trans_t *trans,
 	}
 	else
 	{
-		int stub_len = generate_cross_map_jump(&dest[2], jmp_addr, trans);
-		trans->len = stub_len+2;
-		dest[0] = '\x70'+ (cond^1); /* j!cc over( jmp *mem ) */
-		dest[1] = stub_len;
+		/* jump to a cross-map stub in the cold section of the chunk,
+		 * jit_translate_chunk() generates the stub and fills in the offset
+		 */
+		dest[0] = '\x0F'; /* jcc i32 */
+		dest[1] = '\x80'+cond;
+		*trans = (trans_t){ .jmp_addr=jmp_addr, .imm=2, .len=6, .cold=1 };
 		return trans->len;
 	}
 }
@@ -902,6 +937,170 @@ static int copy_instr(char *dest, instr_t *instr, trans_t *trans)
 	return trans->len;
 }
 
+/* Guest SSE code gets %xmm0-%xmm2 and %xmm8-%xmm15 as they are.  %xmm3-%xmm7
+ * belong to us, the guest's versions live in thread_ctx_t.  An instruction
+ * naming one of those is run on a free register from %xmm0-%xmm2 instead
+ * (at most two are needed, and pblendvb & co. keep their implicit %xmm0):
+ *
+ *     movdqu %xmmC, %fs:xmm_spill[i]
+ *     movdqu %fs:guest_xmm[N-3], %xmmC
+ *     <instruction, with N replaced by C>
+ *     movdqu %xmmC, %fs:guest_xmm[N-3]
+ *     movdqu %fs:xmm_spill[i], %xmmC
+ */
+
+#define SSE_NONE (0)
+#define SSE_REG  (1) /* modrm.reg names an xmm register */
+#define SSE_RM   (2) /* modrm.rm names an xmm register (if mod == 3) */
+#define SSE_XMM0 (4) /* implicit %xmm0 operand */
+
+static int sse_operands(instr_t *instr)
+{
+	int op = instr->op & 0xff,
+	    pfx = instr->p[3] == 0x66 ? 0x66 :
+	          instr->p[1] == 0xf3 ? 0xf3 :
+	          instr->p[1] == 0xf2 ? 0xf2 : 0;
+
+	if ( (instr->op & ~0xff) == G38_OPTABLE )
+	{
+		if (pfx != 0x66)
+			return SSE_NONE; /* mmx */
+
+		if ( (op == 0x10) || (op == 0x14) || (op == 0x15) )
+			return SSE_REG|SSE_RM|SSE_XMM0;
+
+		return SSE_REG|SSE_RM;
+	}
+
+	if ( (instr->op & ~0xff) == G3A_OPTABLE )
+	{
+		if (pfx != 0x66)
+			return SSE_NONE; /* mmx palignr */
+
+		if ( ( (op >= 0x14) && (op <= 0x17) ) || (op == 0x20) || (op == 0x22) )
+			return SSE_REG; /* pextr* / pinsr*, the other operand is r/m32 */
+
+		if ( (op >= 0x60) && (op <= 0x63) )
+			return SSE_REG|SSE_RM|SSE_XMM0;
+
+		return SSE_REG|SSE_RM;
+	}
+
+	/* ESC_OPTABLE, packed / scalar float ops, xmm regardless of prefix */
+	if ( ( (op >= 0x10) && (op <= 0x17) ) || ( (op >= 0x28) && (op <= 0x2F) ) ||
+	     ( (op >= 0x50) && (op <= 0x5F) ) || (op == 0xC2) || (op == 0xC6) )
+	{
+		if (op == 0x2A)
+			return SSE_REG;  /* from mm / r/m32 */
+		if ( (op == 0x2C) || (op == 0x2D) || (op == 0x50) )
+			return SSE_RM;   /* to mm / r32 */
+
+		return SSE_REG|SSE_RM;
+	}
+
+	/* shift groups, modrm.reg is part of the opcode */
+	if ( (op >= 0x71) && (op <= 0x73) )
+		return pfx == 0x66 ? SSE_RM : SSE_NONE;
+
+	/* integer ops, mmx without prefix */
+	switch (pfx)
+	{
+		case 0x66:
+			if ( (op == 0x6E) || (op == 0x7E) || (op == 0xC4) )
+				return SSE_REG;
+			if ( (op == 0xC5) || (op == 0xD7) )
+				return SSE_RM;
+			return SSE_REG|SSE_RM;
+		case 0xf3:
+			if (op == 0xD6)
+				return SSE_REG;  /* movq2dq */
+			return SSE_REG|SSE_RM;
+		case 0xf2:
+			if (op == 0xD6)
+				return SSE_RM;   /* movdq2q */
+			return SSE_REG|SSE_RM;
+		default:
+			return SSE_NONE;
+	}
+}
+
+#define GUEST_XMM(n) ((n) >= 3 && (n) <= 7)
+
+/* movdqu between %xmmN and an absolute %fs: offset, N < 8 */
+static int xmm_ctx_move(char *dest, int store, int xmm, long off)
+{
+	memcpy(dest, "\x64\xf3\x0f\x6f\x04\x25", 6);
+	if (store)
+		dest[3] = '\x7f';
+	dest[4] |= xmm<<3;
+	field_l(&dest[6], off);
+	return 10;
+}
+
+static int generate_sse(char *dest, instr_t *instr, trans_t *trans)
+{
+	int ops = sse_operands(instr);
+	unsigned char mrm = instr->addr[instr->mrm];
+	int reg = ( (mrm>>3) & 7 ) | ( (instr->p[5] & REX_R) ? 8 : 0 ),
+	    rm  = (  mrm     & 7 ) | ( (instr->p[5] & REX_B) ? 8 : 0 );
+	int guest[2], n_guest = 0, busy = 0, carrier[2], i, c, len = 0;
+
+	if ( (instr->p[2] == 0) && (taint_flag == TAINT_ON) ) /* we don't do segments (yet?) */
+		len = taint_sse(dest, instr);
+
+	if ( (mrm & 0xC0) != 0xC0 )
+		ops &= ~SSE_RM;
+
+	if (ops & SSE_REG)
+		busy |= 1<<reg;
+	if (ops & SSE_RM)
+		busy |= 1<<rm;
+	if (ops & SSE_XMM0)
+		busy |= 1;
+
+	if ( (ops & SSE_REG) && GUEST_XMM(reg) )
+		guest[n_guest++] = reg;
+	if ( (ops & SSE_RM) && GUEST_XMM(rm) && !( (ops & SSE_REG) && (rm == reg) ) )
+		guest[n_guest++] = rm;
+
+	if (n_guest == 0)
+	{
+		len += copy_instr(&dest[len], instr, trans);
+		*trans = (trans_t){ .len = len };
+		return len;
+	}
+
+	for (i=0, c=0; i<n_guest; i++, c++)
+	{
+		while ( busy & (1<<c) )
+			c++;
+		carrier[i] = c;
+
+		len += xmm_ctx_move(&dest[len], 1, c, offsetof(thread_ctx_t, xmm_spill[i]));
+		len += xmm_ctx_move(&dest[len], 0, c, offsetof(thread_ctx_t, guest_xmm[guest[i]-3]));
+	}
+
+	memcpy(&dest[len], instr->addr, instr->len);
+	for (i=0; i<n_guest; i++)
+	{
+		if ( (ops & SSE_REG) && (reg == guest[i]) )
+			mrm = ( mrm & ~0x38 ) | ( carrier[i]<<3 );
+		if ( (ops & SSE_RM) && (rm == guest[i]) )
+			mrm = ( mrm & ~0x07 ) | carrier[i];
+	}
+	dest[len+instr->mrm] = mrm;
+	len += instr->len;
+
+	for (i=n_guest-1; i>=0; i--)
+	{
+		len += xmm_ctx_move(&dest[len], 1, carrier[i], offsetof(thread_ctx_t, guest_xmm[guest[i]-3]));
+		len += xmm_ctx_move(&dest[len], 0, carrier[i], offsetof(thread_ctx_t, xmm_spill[i]));
+	}
+
+	*trans = (trans_t){ .len = len };
+	return len;
+}
+
 static int taint_cmpxchg8(char *dest, instr_t *instr, trans_t *trans)
 {
 	int len = 0;
@@ -950,6 +1149,41 @@ static int taint_cmpxchg8b(char *dest, instr_t *instr, trans_t *trans)
 	return trans->len = len;
 }
 
+/* rep movs / rep stos: first the same rep instruction on the shadow memory,
+ * then on the data.  Both run at native (microcoded) string speed and follow
+ * the direction flag.  A fault or signal in either half leaves %ecx, %esi and
+ * %edi where the interrupted rep instruction left them, so jit_fragment()
+ * can finish it.  The shadow goes first, so taint is never behind the data.
+ */
+static int taint_rep_bulk(char *dest, instr_t *instr, trans_t *trans)
+{
+	int len;
+
+	if ( (instr->op == 0xA4) || (instr->op == 0xA5) ) /* movs */
+	{
+		len = TEMPLATE(dest, tpl_rep_movs_pre);
+		field_l(&dest[TPL_REP_MOVS_PRE_SRC_OFF], TAINT_OFFSET);
+		field_l(&dest[TPL_REP_MOVS_PRE_DST_OFF], TAINT_OFFSET);
+		memcpy(&dest[len], instr->addr, instr->len);
+		len += instr->len;
+		len += TEMPLATE(&dest[len], tpl_rep_movs_post);
+	}
+	else /* stos, fill with the taint of %al/%ax/%eax */
+	{
+		len = TEMPLATE(dest, tpl_rep_stos_pre);
+		field_l(&dest[TPL_REP_STOS_PRE_DST_OFF], TAINT_OFFSET);
+		memcpy(&dest[len], instr->addr, instr->len);
+		len += instr->len;
+		len += TEMPLATE(&dest[len], tpl_rep_stos_post);
+	}
+
+	memcpy(&dest[len], instr->addr, instr->len);
+	len += instr->len;
+
+	*trans = (trans_t){ .len = len };
+	return len;
+}
+
 static int taint_rep(char *dest, instr_t *instr, trans_t *trans)
 {
 	int act = jit_action[instr->op]^TAINT, op16 = (instr->p[3] == 0x66);
@@ -957,6 +1191,11 @@ static int taint_rep(char *dest, instr_t *instr, trans_t *trans)
 	if (instr->p[2]) /* we don't do segments (yet?) */
 		return copy_instr(dest, instr, trans);
 
+	if ( (taint_flag == TAINT_ON) && !instr->p[4] && !instr->p[5] &&
+	     ( (instr->op == 0xA4) || (instr->op == 0xA5) ||
+	       (instr->op == 0xAA) || (instr->op == 0xAB) ) )
+		return taint_rep_bulk(dest, instr, trans);
+
 	int len = 2;
 
 	dest[0] = '\xe3';
@@ -1094,6 +1333,111 @@ static void translate_control(char *dest, instr_t *instr, trans_t *trans,
 		trans->jmp_addr = (char *)((long)trans->jmp_addr & 0xffffL);
 }
 
+static int modrm_reg(instr_t *instr)
+{
+	return ((instr->addr[instr->mrm]>>3)&7) | ((instr->p[5]&REX_R) ? 8 : 0);
+}
+
+static int modrm_rm(instr_t *instr)
+{
+	return (instr->addr[instr->mrm]&7) | ((instr->p[5]&REX_B) ? 8 : 0);
+}
+
+static int is_op(instr_t *instr, int op)
+{
+	return (instr->len > 0) && (instr->op == op) && (instr->p[5] & REX_W) &&
+	       !instr->p[1] && !instr->p[2] && !instr->p[3] && !instr->p[4];
+}
+
+/* the PIC form gcc and clang emit for switch tables:
+ *
+ *     lea    table(%rip), b
+ *     movslq (b,idx,4), r
+ *     add    b, r
+ *     jmp    *r
+ *
+ * prev[0] is the instruction right before the jmp, prev[1] the one before that
+ */
+static char *rel_jump_table_addr(instr_t *instr, instr_t *prev)
+{
+	unsigned char *mrm = (unsigned char *)&instr->addr[instr->mrm];
+	int r, b;
+
+	if ( (mrm[0] & 0xC0) != 0xC0 )
+		return NULL;
+
+	r = modrm_rm(instr);
+
+	if ( (prev[0].addr+prev[0].len != instr->addr) ||
+	     (prev[1].addr+prev[1].len != prev[0].addr) ||
+	     (prev[2].addr+prev[2].len != prev[1].addr) )
+		return NULL;
+
+	/* add b, r */
+	mrm = (unsigned char *)&prev[0].addr[prev[0].mrm];
+	if ( is_op(&prev[0], 0x01) && ((mrm[0] & 0xC0) == 0xC0) && (modrm_rm(&prev[0]) == r) )
+		b = modrm_reg(&prev[0]);
+	else if ( is_op(&prev[0], 0x03) && ((mrm[0] & 0xC0) == 0xC0) && (modrm_reg(&prev[0]) == r) )
+		b = modrm_rm(&prev[0]);
+	else
+		return NULL;
+
+	/* movslq (b,idx,4), r */
+	mrm = (unsigned char *)&prev[1].addr[prev[1].mrm];
+	if ( !is_op(&prev[1], 0x63) || (modrm_reg(&prev[1]) != r) ||
+	     (mrm[0] & 0xC7) != 0x04 ||                 /* mod 00, r/m 100: sib follows */
+	     (mrm[1] & 0xC7) == 0x85 ||                 /* there is a base register     */
+	     (mrm[1] & 0xC0) != 0x80 ||                 /* scale 4                      */
+	     ((mrm[1] & 7) | ((prev[1].p[5]&REX_B) ? 8 : 0)) != b )
+		return NULL;
+
+	/* lea table(%rip), b */
+	mrm = (unsigned char *)&prev[2].addr[prev[2].mrm];
+	if ( !is_op(&prev[2], 0x8D) || (modrm_reg(&prev[2]) != b) ||
+	     ((mrm[0] & 0xC7) != 0x05) || (prev[2].len - prev[2].mrm != 5) )
+		return NULL;
+
+	return prev[2].addr + prev[2].len + (int)imm_at((char *)&mrm[1], 4);
+}
+
+/* recognises jmp *table(,reg,8) (and jmp *table(,reg,4) on i386) and the
+ * PIC sequence above, returns the address of the table and sets *kind
+ * to the type of its entries
+ */
+char *jump_table_addr(instr_t *instr, instr_t *prev, int *kind)
+{
+	unsigned char *mrm = (unsigned char *)&instr->addr[instr->mrm];
+
+	/* 0x3E is the notrack prefix of -fcf-protection */
+	if ( (jit_action[instr->op] != JUMP_INDIRECT) ||
+	     (instr->p[2] && instr->p[2] != 0x3E) || instr->p[3] || instr->p[4] )
+		return NULL;
+
+#ifdef __x86_64__
+	*kind = JUMP_TABLE_REL32;
+	if ( (prev != NULL) && !(instr->p[5] & REX_W) && (instr->len - instr->mrm == 1) )
+		return rel_jump_table_addr(instr, prev);
+
+	*kind = JUMP_TABLE_ABS64;
+	if ( (instr->len - instr->mrm != 6) ||
+	     ((mrm[0] & 0xC7) != 0x04) ||   /* mod 00, r/m 100: sib follows */
+	     ((mrm[1] & 0xC7) != 0xC5) ||   /* scale 8, no base: disp32     */
+	     ( ((mrm[1] & 0x38) == 0x20) && !(instr->p[5] & REX_X) ) ) /* no index */
+		return NULL;
+
+	return (char *)(long)(int)imm_at((char *)&mrm[2], 4);
+#else
+	*kind = JUMP_TABLE_ABS32;
+	if ( (instr->len - instr->mrm != 6) ||
+	     ((mrm[0] & 0xC7) != 0x04) ||   /* mod 00, r/m 100: sib follows */
+	     ((mrm[1] & 0xC7) != 0x85) ||   /* scale 4, no base: disp32     */
+	     ((mrm[1] & 0x38) == 0x20) )    /* no index                     */
+		return NULL;
+
+	return (char *)(imm_at((char *)&mrm[2], 4) & 0xffffffffL);
+#endif
+}
+
 void translate_op(char *dest, instr_t *instr, trans_t *trans,
                   char *map, unsigned long map_len)
 {
@@ -1131,6 +1475,8 @@ void translate_op(char *dest, instr_t *instr, trans_t *trans,
 		taint_cmpxchg8b(dest, instr, trans);
 	else if (action == CPUID)
 		generate_cpuid(dest, instr, trans);
+	else if (action == SSE)
+		generate_sse(dest, instr, trans);
 	else
 			die("unimplemented action: %d", action);
 }
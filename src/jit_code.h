@@ -39,6 +39,7 @@ typedef struct
 {
 	char *jmp_addr;
 	unsigned char imm, len;
+	unsigned char cold; /* imm points to an out-of-line stub for jmp_addr */
 
 } trans_t;
 
@@ -54,9 +55,19 @@ int generate_ill(char *dest, trans_t *trans);
 void translate_op(char *dest, instr_t *instr, trans_t *trans,
                   char *map, unsigned long map_len);
 
-int generate_hook(char *dest, char *addr, hook_func_t func);
+int generate_hook(char *dest, char *addr, hook_func_t func, char *jit_ret);
+
+#define MAX_STACK_RUN (8)
+int generate_stack_run(char *dest, instr_t *instr, trans_t *trans, long max_run);
+int generate_syscall_direct(char *dest, instr_t *instr, trans_t *trans, long max_run,
+                            char *map, unsigned long map_len);
 
 int generate_jump(char *jit_addr, char *dest, trans_t *trans, char *map, unsigned long map_len);
+enum { JUMP_TABLE_ABS32, JUMP_TABLE_ABS64, JUMP_TABLE_REL32 };
+char *jump_table_addr(instr_t *instr, instr_t *prev, int *kind);
+
+int generate_cross_map_jump(char *dest, char *jmp_addr, trans_t *trans);
+int generate_backedge_check(char *dest, char *jmp_addr, trans_t *trans);
 int generate_stub(char *jit_addr, char *jmp_addr, char *imm_addr);
 
 #define COPY_INSTRUCTION       (0)
@@ -91,6 +102,7 @@ int generate_stub(char *jit_addr, char *jmp_addr, char *imm_addr);
 #define CMPXCHG                (0x43)
 #define CMPXCHG8B              (0x44)
 #define CPUID                  (0x45)
+#define SSE                    (0x47)
 
 #define JOIN (CONTROL|12)
 
@@ -34,6 +34,10 @@
 /* On the event of a signal we may need to finish the emulation of an instruction.
  * So we need to translate our jit code of one emulated instruction into code which
  * switches back after that instruction is done.
+ *
+ * The fragment is written through the writable alias of the jit_fragment page and
+ * runs from the executable one, delta bytes further.  Jumps within the fragment
+ * do not care, jumps out of it are aimed at target-delta.
  */
 
 static long jit_fragment_jcc(char *dest, instr_t *instr, char *jump_jit_addr)
@@ -48,7 +52,7 @@ static long jit_fragment_jcc(char *dest, instr_t *instr, char *jump_jit_addr)
 	);
 }
 
-static long jit_fragment_jcc_exit(char *dest, instr_t *instr, char *jump_addr)
+static long jit_fragment_jcc_exit(char *dest, instr_t *instr, char *jump_addr, long delta)
 {
 	int len = gen_code(
 		dest,
@@ -59,7 +63,7 @@ static long jit_fragment_jcc_exit(char *dest, instr_t *instr, char *jump_addr)
 		(instr->addr[instr->mrm-1]^1) & 0x0f,
 		offsetof(thread_ctx_t, jit_rip), jump_addr
 	);
-	return len+jump_to(&dest[len], (char *)(long)jit_fragment_exit);
+	return len+jump_to(&dest[len], (char *)(long)jit_fragment_exit - delta);
 }
 
 static long jit_fragment_jump(char *dest, char *jump_jit_addr)
@@ -67,7 +71,7 @@ static long jit_fragment_jump(char *dest, char *jump_jit_addr)
 	return jump_to(dest, jump_jit_addr);
 }
 
-static long jit_fragment_jump_exit(char *dest, char *jump_addr)
+static long jit_fragment_jump_exit(char *dest, char *jump_addr, long delta)
 {
 	int len = gen_code(
 		dest,
@@ -76,12 +80,12 @@ static long jit_fragment_jump_exit(char *dest, char *jump_addr)
 
 		offsetof(thread_ctx_t, jit_rip), jump_addr
 	);
-	return len+jump_to(&dest[len], (char *)(long)jit_fragment_exit);
+	return len+jump_to(&dest[len], (char *)(long)jit_fragment_exit - delta);
 }
 
 static long jit_fragment_control(char *dest, instr_t *instr,
                                  char *addr, unsigned long len,
-                                 char *mapping[])
+                                 char *mapping[], long delta)
 {
 	long code_len, off=0;
 	char *pc = &instr->addr[instr->len],
@@ -93,7 +97,7 @@ static long jit_fragment_control(char *dest, instr_t *instr,
 			if ( contains(addr, len+1, jump_addr) )
 				return jit_fragment_jcc(dest, instr, mapping[jump_addr-addr]);
 			else
-				return jit_fragment_jcc_exit(dest, instr, jump_addr);
+				return jit_fragment_jcc_exit(dest, instr, jump_addr, delta);
 
 		case LOOP: /* loops */
 			off = gen_code(
@@ -108,7 +112,7 @@ static long jit_fragment_control(char *dest, instr_t *instr,
 			if ( contains(addr, len+1, jump_addr) )
 				code_len = off + jit_fragment_jump(&dest[off], mapping[jump_addr-addr]);
 			else
-				code_len = off + jit_fragment_jump_exit(&dest[off], jump_addr);
+				code_len = off + jit_fragment_jump_exit(&dest[off], jump_addr, delta);
 
 			dest[off-1] = code_len-off; /* 1.) */
 
@@ -119,11 +123,11 @@ static long jit_fragment_control(char *dest, instr_t *instr,
 				return jit_fragment_jump(dest, mapping[jump_addr-addr]);
 			else if ( between(runtime_cache_resolution_start, runtime_cache_resolution_end, jump_addr) )
 				return jit_fragment_jump(dest, jump_addr + (long)reloc_runtime_cache_resolution_start-
-				                                                 (long)runtime_cache_resolution_start);
+				                                                 (long)runtime_cache_resolution_start - delta);
 			else if ( between(minemu_code_start, minemu_code_end, jump_addr) )
-				return jit_fragment_jump(dest, jump_addr);
+				return jit_fragment_jump(dest, jump_addr - delta);
 			else
-				return jit_fragment_jump_exit(dest, jump_addr);
+				return jit_fragment_jump_exit(dest, jump_addr, delta);
 
 		case CALL_RELATIVE: /* unimplemented, not needed, (not used by code generation) */
 		case CALL_INDIRECT:
@@ -140,7 +144,8 @@ static long jit_fragment_control(char *dest, instr_t *instr,
 }
 
 static char *jit_fragment_translate(char *addr, long len, char *entry,
-                                    char jit_addr[], long jit_len, char *mapping[])
+                                    char jit_addr[], long jit_len, char *mapping[],
+                                    long delta)
 {
 	instr_t instr;
 
@@ -156,7 +161,7 @@ static char *jit_fragment_translate(char *addr, long len, char *entry,
 
 		if ( s_off == len )
 		{
-			jit_fragment_jump_exit(&jit_addr[d_off], &addr[s_off]);
+			jit_fragment_jump_exit(&jit_addr[d_off], &addr[s_off], delta);
 			break;
 		}
 
@@ -167,7 +172,7 @@ static char *jit_fragment_translate(char *addr, long len, char *entry,
 			die("jit_fragment too large");
 
 		if ( (jit_action[instr.op] & CONTROL_MASK) == CONTROL )
-			d_off += jit_fragment_control(&jit_addr[d_off], &instr, addr, len, mapping);
+			d_off += jit_fragment_control(&jit_addr[d_off], &instr, addr, len, mapping, delta);
 		else
 		{
 			memcpy(&jit_addr[d_off], instr.addr, instr.len);
@@ -180,7 +185,7 @@ static char *jit_fragment_translate(char *addr, long len, char *entry,
 	if ( jit_entry == NULL )
 		die("fragment entry point not in translated code");
 
-	return jit_entry;
+	return jit_entry + delta;
 }
 
 static char *jit_fragment(char *fragment, long len, char *entry)
@@ -188,12 +193,13 @@ static char *jit_fragment(char *fragment, long len, char *entry)
 	thread_ctx_t *local_ctx = get_thread_ctx();
 	char *jit_entry;
 	char *mapping[len+1];
-	char *jit_fragment_page = local_ctx->jit_fragment_page;
+	char *jit_fragment_page = writable_ctx()->jit_fragment_page;
 	long code_sz = sizeof( local_ctx->jit_fragment_page );
+	long delta = local_ctx->jit_fragment_page - jit_fragment_page;
 
 	/* two-pass, we build up the jump-mapping beforehand */
-	            jit_fragment_translate(fragment, len, entry, jit_fragment_page, code_sz, mapping);
-	jit_entry = jit_fragment_translate(fragment, len, entry, jit_fragment_page, code_sz, mapping);
+	            jit_fragment_translate(fragment, len, entry, jit_fragment_page, code_sz, mapping, delta);
+	jit_entry = jit_fragment_translate(fragment, len, entry, jit_fragment_page, code_sz, mapping, delta);
 
 	return jit_entry;
 }
@@ -224,8 +230,6 @@ char *finish_instruction(struct sigcontext *context)
 			return orig_rip;
 		}
 
-		unprotect_ctx();
-
 		if ( orig_rip )
 			/* jit the jit! */
 			context->rip = (long)jit_fragment(jit_op_start, jit_op_len, (char *)context->rip);
@@ -240,17 +244,13 @@ char *finish_instruction(struct sigcontext *context)
 			/* instead of jumping directly to the resolved address, return here */
 			context->rip += reloc_runtime_cache_resolution_start-runtime_cache_resolution_start;
 
-		local_ctx->runtime_ijmp_addr = reloc_runtime_ijmp;
-		local_ctx->jit_return_addr = reloc_jit_return;
+		writable_ctx()->runtime_ijmp_addr = reloc_runtime_ijmp;
+		writable_ctx()->jit_return_addr = reloc_jit_return;
 
-		protect_ctx();
 		jit_fragment_run(context);
-		unprotect_ctx();
-
-		local_ctx->runtime_ijmp_addr = runtime_ijmp;
-		local_ctx->jit_return_addr = jit_return;
 
-		protect_ctx();
+		writable_ctx()->runtime_ijmp_addr = runtime_ijmp;
+		writable_ctx()->jit_return_addr = jit_return;
 
 		if (context->fpstate) /* very likely :-) */
 		{
@@ -47,7 +47,11 @@ static unsigned long block_size;
 
 void jit_mem_init(void)
 {
-	block_size = BLOCK_SIZE;
+	/* with huge pages, every block gets its own (set of) huge page(s) so
+	 * that different maps do not share iTLB entries, or split pages when
+	 * their permissions get flipped.
+	 */
+	block_size = use_hugepages ? HUGE_PG_SIZE : BLOCK_SIZE;
 	n_blocks = JIT_SIZE/block_size;
 	memset(blocks, 0, sizeof(blocks));
 	blocks[0] = n_blocks;
@@ -105,6 +109,8 @@ static void use_blocks(long i, long count)
 
 	if (ret & PG_MASK)
 		die("use_blocks(): mprotect: %d", ret);
+
+	advise_hugepages((unsigned long)get_alloc_pointer(i), count*block_size);
 }
 
 static void disuse_blocks(long i, long count)
@@ -167,6 +173,14 @@ void *jit_mem_balloon(void *p)
 	return p;
 }
 
+/* start of the region which needs to be made writable to append code at
+ * offset off. We never split huge pages with permission changes.
+ */
+unsigned long jit_mem_prot_base(unsigned long off)
+{
+	return use_hugepages ? HUGE_PAGE_BASE(off) : PAGE_BASE(off);
+}
+
 unsigned long jit_mem_size(void *p)
 {
 	return -blocks[get_alloc_block(p)]*block_size;
@@ -24,6 +24,7 @@ void jit_mem_init(void);
 void jit_mem_free(void *p);
 void *jit_mem_balloon(void *p); /* get largest possible memory region */
 unsigned long jit_mem_size(void *p);
+unsigned long jit_mem_prot_base(unsigned long off);
 unsigned long jit_mem_try_resize(void *p, unsigned long requested_size);
 
 #endif /* JIT_MM_H */
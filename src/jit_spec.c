@@ -0,0 +1,186 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <linux/futex.h>
+
+#include "lib.h"
+#include "mm.h"
+#include "jit.h"
+#include "jit_spec.h"
+#include "elf_symbols.h"
+#include "syscalls.h"
+#include "threads.h"
+#include "error.h"
+
+/* Speculative translation
+ *
+ * A helper thread translates code which is likely to be executed soon,
+ * so that guest threads find it already translated.  Candidates are
+ * the targets of direct jumps and calls into other code maps, found during
+ * translation, and the functions in the symbol table of newly mapped
+ * executables.  The helper takes jit_lock and runs jit_translate_ahead()
+ * on the jit stack, just like a guest thread which misses in runtime_ijmp,
+ * so publication of the new code follows the usual protocol: the code is
+ * written beyond map->jit_len, which gets updated last.
+ *
+ * The helper may only read guest code which is still mapped: mm.c holds
+ * jit_lock over calls which unmap code or take away its permissions and
+ * removes the code region before letting go, jit_translate_ahead() checks
+ * the code map under jit_lock.
+ */
+
+int jit_speculate = 0;
+
+#define SPEC_QUEUE_SIZE (4096)
+
+static struct
+{
+	char *addr[SPEC_QUEUE_SIZE];
+	unsigned long head, tail;
+	long lock;
+	int seq, waiting;
+
+} queue;
+
+static int started = 0;
+
+void call_on_jit_stack(void (*fn)(char *), char *arg);
+
+/* *addr may be NULL, for an address dropped by jit_spec_forget() */
+static int jit_spec_get(char **addr)
+{
+	int ret = 0;
+
+	mutex_lock(&queue.lock);
+	if (queue.head != queue.tail)
+	{
+		*addr = queue.addr[queue.tail % SPEC_QUEUE_SIZE];
+		queue.tail++;
+		ret = 1;
+	}
+	mutex_unlock(&queue.lock);
+
+	return ret;
+}
+
+static void jit_spec_thread(thread_ctx_t *helper_ctx)
+{
+	char *addr;
+	int seq;
+
+	init_helper_thread(helper_ctx);
+
+	for (;;)
+	{
+		seq = queue.seq;
+
+		if (!jit_spec_get(&addr))
+		{
+			queue.waiting = 1;
+			commit();
+			if (queue.head == queue.tail)
+				sys_futex(&queue.seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+			queue.waiting = 0;
+			continue;
+		}
+
+		if (addr == NULL)
+			continue;
+
+		mutex_lock(&jit_lock);
+		call_on_jit_stack(jit_translate_ahead, addr);
+		mutex_unlock(&jit_lock);
+	}
+}
+
+/* (re)starts the helper thread, also called in the child after a fork */
+void jit_spec_init(void)
+{
+	if (!jit_speculate)
+		return;
+
+	memset(&queue, 0, sizeof(queue));
+	mutex_init(&queue.lock);
+
+	started = start_helper_thread(jit_spec_thread) > 0;
+	if (!started)
+		debug("minemu: could not start speculative translation thread");
+}
+
+/* queue addr for translation, drops addresses when the queue is full */
+void jit_spec_queue(char *addr)
+{
+	if (!started)
+		return;
+
+	mutex_lock(&queue.lock);
+	if (queue.head - queue.tail < SPEC_QUEUE_SIZE)
+	{
+		queue.addr[queue.head % SPEC_QUEUE_SIZE] = addr;
+		queue.head++;
+		queue.seq++;
+	}
+	mutex_unlock(&queue.lock);
+
+	if (queue.waiting)
+		sys_futex(&queue.seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* drops the queued addresses in a code region which is going away,
+ * called by del_code_region() with jit_lock held
+ */
+void jit_spec_forget(char *addr, unsigned long len)
+{
+	unsigned long i;
+
+	if (!started)
+		return;
+
+	mutex_lock(&queue.lock);
+	for (i=queue.tail; i!=queue.head; i++)
+		if ( contains(addr, len, queue.addr[i % SPEC_QUEUE_SIZE]) )
+			queue.addr[i % SPEC_QUEUE_SIZE] = NULL;
+	mutex_unlock(&queue.lock);
+}
+
+typedef struct
+{
+	char *addr;
+	unsigned long len, off;
+
+} sym_map_t;
+
+static void queue_symbol(unsigned long offset, unsigned long size, void *arg)
+{
+	sym_map_t *m = arg;
+
+	if ( (offset >= m->off) && (offset-m->off < m->len) )
+		jit_spec_queue(&m->addr[offset-m->off]);
+}
+
+/* queue the functions of an executable mapping of fd */
+void jit_spec_queue_symbols(int fd, char *addr, unsigned long len,
+                                    unsigned long pgoffset)
+{
+	if (!started || fd < 0)
+		return;
+
+	sym_map_t m = { .addr = addr, .len = len, .off = pgoffset*PG_SIZE };
+	elf_func_symbols(fd, queue_symbol, &m);
+}
@@ -0,0 +1,30 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JIT_SPEC_H
+#define JIT_SPEC_H
+
+extern int jit_speculate;
+
+void jit_spec_init(void);
+void jit_spec_queue(char *addr);
+void jit_spec_forget(char *addr, unsigned long len);
+void jit_spec_queue_symbols(int fd, char *addr, unsigned long len,
+                                    unsigned long pgoffset);
+
+#endif /* JIT_SPEC_H */
@@ -0,0 +1,357 @@
+/* generated by gen/tablegen_templates.py, do not edit */
+
+#ifndef JIT_TEMPLATES_H
+#define JIT_TEMPLATES_H
+
+/* xmm_save:
+ *     pinsrd $0, %ecx, %xmm4
+ *     pinsrd $0, %eax, %xmm3
+ */
+static const unsigned char tpl_xmm_save[] =
+{
+	0x66, 0x0F, 0x3A, 0x22, 0xE1, 0x00, 0x66, 0x0F, 0x3A, 0x22, 0xD8, 0x00,
+};
+
+/* clear_ijmp_taint:
+ *     pxor %xmm5, %xmm5
+ */
+static const unsigned char tpl_clear_ijmp_taint[] =
+{
+	0x66, 0x0F, 0xEF, 0xED,
+};
+
+/* hook:
+ *     movl func, hook
+ *     movl addr, user_eip
+ *     movl jit_ret, jit_eip
+ *     jmp hook_stub
+ */
+static const unsigned char tpl_hook[] =
+{
+	0x64, 0xC7, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64,
+	0xC7, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0xC7,
+	0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE9, 0x00, 0x00,
+	0x00, 0x00,
+};
+enum
+{
+	TPL_HOOK_FUNC_OFF = 3,
+	TPL_HOOK_FUNC = 7,
+	TPL_HOOK_RIP_OFF = 14,
+	TPL_HOOK_ADDR = 18,
+	TPL_HOOK_JIT_OFF = 25,
+	TPL_HOOK_JIT = 29,
+	TPL_HOOK_STUB = 34,
+};
+
+/* sysenter:
+ *     pxor %xmm5, %xmm5
+ *     jmp linux_sysenter_emu
+ */
+static const unsigned char tpl_sysenter[] =
+{
+	0x66, 0x0F, 0xEF, 0xED, 0xE9, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_SYSENTER_EMU = 5,
+};
+
+/* syscall:
+ *     pxor %xmm5, %xmm5
+ *     movq $post_addr, user_eip
+ *     movq $post_jit, jit_eip
+ *     jmp linux_syscall_emu / linux_syscall_direct
+ */
+static const unsigned char tpl_syscall[] =
+{
+	0x66, 0x0F, 0xEF, 0xED, 0x64, 0x48, 0xC7, 0x04, 0x25, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0x48, 0xC7, 0x04, 0x25, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE9, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_SYSCALL_RIP_OFF = 9,
+	TPL_SYSCALL_ADDR = 13,
+	TPL_SYSCALL_JIT_OFF = 22,
+	TPL_SYSCALL_JIT = 26,
+	TPL_SYSCALL_EMU = 31,
+};
+
+/* int80:
+ *     pxor %xmm5, %xmm5
+ *     movl $post_addr, user_eip
+ *     jmp int80_emu
+ */
+static const unsigned char tpl_int80[] =
+{
+	0x66, 0x0F, 0xEF, 0xED, 0x64, 0xC7, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0xE9, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_INT80_RIP_OFF = 7,
+	TPL_INT80_ADDR = 11,
+	TPL_INT80_EMU = 16,
+};
+
+/* cpuid:
+ *     movl $post_addr, jit_eip
+ *     jmp cpuid_emu
+ */
+static const unsigned char tpl_cpuid[] =
+{
+	0x64, 0xC7, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE9,
+	0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_CPUID_JIT_OFF = 3,
+	TPL_CPUID_JIT = 7,
+	TPL_CPUID_EMU = 12,
+};
+
+/* ijump_tail:
+ *     pextrd $0, %xmm5, %ecx
+ *     jmp runtime_ijmp
+ */
+static const unsigned char tpl_ijump_tail[] =
+{
+	0x66, 0x0F, 0x3A, 0x16, 0xE9, 0x00, 0xE9, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_IJUMP_TAIL_RUNTIME_IJMP = 7,
+};
+
+/* call_preseed:
+ *     push $retaddr
+ *     movl $addr,     jmp_cache[HASH_INDEX(addr)].addr
+ *     movl $jit_addr, jmp_cache[HASH_INDEX(addr)].jit_addr
+ */
+static const unsigned char tpl_call_preseed[] =
+{
+	0x68, 0x00, 0x00, 0x00, 0x00, 0x64, 0xC7, 0x05, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00, 0x00, 0x64, 0xC7, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00,
+	0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_CALL_PRESEED_RETADDR = 1,
+	TPL_CALL_PRESEED_ADDR_OFF = 8,
+	TPL_CALL_PRESEED_ADDR = 12,
+	TPL_CALL_PRESEED_JIT_OFF = 19,
+	TPL_CALL_PRESEED_JIT = 23,
+};
+
+/* call_prefetch:
+ *     push $retaddr
+ *     prefetch jmp_cache[HASH_INDEX(addr)]
+ */
+static const unsigned char tpl_call_prefetch[] =
+{
+	0x68, 0x00, 0x00, 0x00, 0x00, 0x64, 0x0F, 0x18, 0x0D, 0x00, 0x00, 0x00,
+	0x00,
+};
+enum
+{
+	TPL_CALL_PREFETCH_RETADDR = 1,
+	TPL_CALL_PREFETCH_CACHE_OFF = 9,
+};
+
+/* call_lazy:
+ *     push $retaddr
+ */
+static const unsigned char tpl_call_lazy[] =
+{
+	0x68, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_CALL_LAZY_RETADDR = 1,
+};
+
+/* icall_preseed:
+ *     pextrd $0, %xmm5, %ecx
+ *     push $retaddr
+ *     movl $addr,     jmp_cache[HASH_INDEX(addr)].addr
+ *     movl $jit_addr, jmp_cache[HASH_INDEX(addr)].jit_addr
+ *     jmp runtime_ijmp
+ */
+static const unsigned char tpl_icall_preseed[] =
+{
+	0x66, 0x0F, 0x3A, 0x16, 0xE9, 0x00, 0x68, 0x00, 0x00, 0x00, 0x00, 0x64,
+	0xC7, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x64, 0xC7,
+	0x05, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xE9, 0x00, 0x00,
+	0x00, 0x00,
+};
+enum
+{
+	TPL_ICALL_PRESEED_RETADDR = 7,
+	TPL_ICALL_PRESEED_ADDR_OFF = 14,
+	TPL_ICALL_PRESEED_ADDR = 18,
+	TPL_ICALL_PRESEED_JIT_OFF = 25,
+	TPL_ICALL_PRESEED_JIT = 29,
+	TPL_ICALL_PRESEED_RUNTIME_IJMP = 34,
+};
+
+/* icall_prefetch:
+ *     pextrd $0, %xmm5, %ecx
+ *     push $retaddr
+ *     prefetch jmp_cache[HASH_INDEX(addr)]
+ *     jmp runtime_ijmp
+ */
+static const unsigned char tpl_icall_prefetch[] =
+{
+	0x66, 0x0F, 0x3A, 0x16, 0xE9, 0x00, 0x68, 0x00, 0x00, 0x00, 0x00, 0x64,
+	0x0F, 0x18, 0x0D, 0x00, 0x00, 0x00, 0x00, 0xE9, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_ICALL_PREFETCH_RETADDR = 7,
+	TPL_ICALL_PREFETCH_CACHE_OFF = 15,
+	TPL_ICALL_PREFETCH_RUNTIME_IJMP = 20,
+};
+
+/* icall_lazy:
+ *     pextrd $0, %xmm5, %ecx
+ *     push $retaddr
+ *     jmp runtime_ijmp
+ */
+static const unsigned char tpl_icall_lazy[] =
+{
+	0x66, 0x0F, 0x3A, 0x16, 0xE9, 0x00, 0x68, 0x00, 0x00, 0x00, 0x00, 0xE9,
+	0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_ICALL_LAZY_RETADDR = 7,
+	TPL_ICALL_LAZY_RUNTIME_IJMP = 12,
+};
+
+/* ret_cleanup:
+ *     pinsrd $0, %ecx, %xmm4
+ *     pinsrd $0, %eax, %xmm3
+ *     mov TAINT_OFFSET(%esp), %ecx
+ *     pop %eax
+ *     lea N(%esp),%esp
+ *     jmp runtime_ijmp
+ */
+static const unsigned char tpl_ret_cleanup[] =
+{
+	0x66, 0x0F, 0x3A, 0x22, 0xE1, 0x00, 0x66, 0x0F, 0x3A, 0x22, 0xD8, 0x00,
+	0x8B, 0x8C, 0x24, 0x00, 0x00, 0x00, 0x00, 0x58, 0x8D, 0xA4, 0x24, 0x00,
+	0x00, 0x00, 0x00, 0xE9, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_RET_CLEANUP_TAINT_OFF = 15,
+	TPL_RET_CLEANUP_N = 23,
+	TPL_RET_CLEANUP_RUNTIME_IJMP = 28,
+};
+
+/* cross_map_jump:
+ *     pinsrd $0, %ecx, %xmm4
+ *     pinsrd $0, %eax, %xmm3
+ *     mov jmp_addr, %eax
+ *     mov $0x0,%ecx
+ *     jmp runtime_ijmp
+ */
+static const unsigned char tpl_cross_map_jump[] =
+{
+	0x66, 0x0F, 0x3A, 0x22, 0xE1, 0x00, 0x66, 0x0F, 0x3A, 0x22, 0xD8, 0x00,
+	0xB8, 0x00, 0x00, 0x00, 0x00, 0xB9, 0x00, 0x00, 0x00, 0x00, 0xE9, 0x00,
+	0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_CROSS_MAP_JUMP_JMP_ADDR = 13,
+	TPL_CROSS_MAP_JUMP_RUNTIME_IJMP = 23,
+};
+
+/* rep_movs_pre:
+ *     pinsrd $0, %ecx, %xmm4
+ *     pinsrd $1, %esi, %xmm4
+ *     pinsrd $2, %edi, %xmm4
+ *     lea TAINT_OFFSET(%esi), %esi
+ *     lea TAINT_OFFSET(%edi), %edi
+ */
+static const unsigned char tpl_rep_movs_pre[] =
+{
+	0x66, 0x0F, 0x3A, 0x22, 0xE1, 0x00, 0x66, 0x0F, 0x3A, 0x22, 0xE6, 0x01,
+	0x66, 0x0F, 0x3A, 0x22, 0xE7, 0x02, 0x8D, 0xB6, 0x00, 0x00, 0x00, 0x00,
+	0x8D, 0xBF, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_REP_MOVS_PRE_SRC_OFF = 20,
+	TPL_REP_MOVS_PRE_DST_OFF = 26,
+};
+
+/* rep_movs_post:
+ *     pextrd $0, %xmm4, %ecx
+ *     pextrd $1, %xmm4, %esi
+ *     pextrd $2, %xmm4, %edi
+ */
+static const unsigned char tpl_rep_movs_post[] =
+{
+	0x66, 0x0F, 0x3A, 0x16, 0xE1, 0x00, 0x66, 0x0F, 0x3A, 0x16, 0xE6, 0x01,
+	0x66, 0x0F, 0x3A, 0x16, 0xE7, 0x02,
+};
+
+/* rep_stos_pre:
+ *     pinsrd $0, %ecx, %xmm4
+ *     pinsrd $2, %edi, %xmm4
+ *     pinsrd $3, %eax, %xmm4
+ *     pextrd $0, %xmm6, %eax
+ *     lea TAINT_OFFSET(%edi), %edi
+ */
+static const unsigned char tpl_rep_stos_pre[] =
+{
+	0x66, 0x0F, 0x3A, 0x22, 0xE1, 0x00, 0x66, 0x0F, 0x3A, 0x22, 0xE7, 0x02,
+	0x66, 0x0F, 0x3A, 0x22, 0xE0, 0x03, 0x66, 0x0F, 0x3A, 0x16, 0xF0, 0x00,
+	0x8D, 0xBF, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_REP_STOS_PRE_DST_OFF = 26,
+};
+
+/* rep_stos_post:
+ *     pextrd $0, %xmm4, %ecx
+ *     pextrd $2, %xmm4, %edi
+ *     pextrd $3, %xmm4, %eax
+ */
+static const unsigned char tpl_rep_stos_post[] =
+{
+	0x66, 0x0F, 0x3A, 0x16, 0xE1, 0x00, 0x66, 0x0F, 0x3A, 0x16, 0xE7, 0x02,
+	0x66, 0x0F, 0x3A, 0x16, 0xE0, 0x03,
+};
+
+/* backedge_check:
+ *     pinsrd $0, %ecx, %xmm4
+ *     mov %fs:taint_live, %ecx
+ *     jrcxz 1f
+ *     pinsrd $0, %eax, %xmm3
+ *     mov jmp_addr, %eax
+ *     mov $0x0,%ecx
+ *     jmp runtime_ijmp
+ *     1: pextrd $0, %xmm4, %ecx
+ *     jmp target
+ */
+static const unsigned char tpl_backedge_check[] =
+{
+	0x66, 0x0F, 0x3A, 0x22, 0xE1, 0x00, 0x64, 0x8B, 0x0C, 0x25, 0x00, 0x00,
+	0x00, 0x00, 0xE3, 0x15, 0x66, 0x0F, 0x3A, 0x22, 0xD8, 0x00, 0xB8, 0x00,
+	0x00, 0x00, 0x00, 0xB9, 0x00, 0x00, 0x00, 0x00, 0xE9, 0x00, 0x00, 0x00,
+	0x00, 0x66, 0x0F, 0x3A, 0x16, 0xE1, 0x00, 0xE9, 0x00, 0x00, 0x00, 0x00,
+};
+enum
+{
+	TPL_BACKEDGE_CHECK_LIVE_OFF = 10,
+	TPL_BACKEDGE_CHECK_JMP_ADDR = 23,
+	TPL_BACKEDGE_CHECK_RUNTIME_IJMP = 33,
+	TPL_BACKEDGE_CHECK_TARGET = 44,
+};
+
+#endif /* JIT_TEMPLATES_H */
@@ -136,6 +136,21 @@ void *memcpy(void *v_dest, const void *v_src, size_t n)
 	return v_dest;
 }
 
+void *memmove(void *v_dest, const void *v_src, size_t n)
+{
+	const char *src=v_src;
+	char *dest=v_dest;
+	size_t i;
+
+	if (dest <= src || dest >= src+n)
+		return memcpy(v_dest, v_src, n);
+
+	for (i=n; i>0; i--)
+		dest[i-1] = src[i-1];
+
+	return v_dest;
+}
+
 void *__memcpy_chk(void *v_dest, const void *v_src, size_t n, size_t dest_size)
 {
 	if (n > dest_size)
@@ -0,0 +1,300 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ * Copyright 2011 Vrije Universiteit Amsterdam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "libc_summary.h"
+#include "hooks.h"
+#include "elf_symbols.h"
+#include "taint.h"
+#include "taint_summary.h"
+#include "opcodes.h"
+#include "threads.h"
+#include "runtime.h"
+#include "lib.h"
+#include "mm.h"
+
+/* Function summaries: some libc string functions are replaced as a whole by
+ * a native implementation which does the same to the data and to the shadow
+ * memory.  The hook sits on the first instruction of the function, does the
+ * work and returns straight to the caller (through state_restore) so none
+ * of the instrumented function body runs.
+ *
+ * Arguments follow the x86_64 calling convention: rdi, rsi, rdx.  Whenever
+ * something looks off (tainted or trapped return address, memory which is
+ * not known to be accessible, see user_readable() in mm.c) the summary backs
+ * out and lets the real function run, so a fault is raised by guest code.
+ *
+ * Copies go a word at a time.  The guest's %xmm0-%xmm2 and %xmm8-%xmm15 are
+ * still live when a hook runs, so SSE is not an option here.
+ */
+
+int libc_summaries = 0;
+
+#define SHADOW(p) ((char *)(p)+TAINT_OFFSET)
+
+typedef unsigned long __attribute__((may_alias, aligned(1))) word_t;
+
+/* returns the bitwise or of everything copied */
+static unsigned long copy_mem(char *dest, const char *src, unsigned long n)
+{
+	unsigned long i, any = 0;
+
+	if ( (dest <= src) || (dest >= src+n) )
+	{
+		for (i=0; i+sizeof(word_t) <= n; i+=sizeof(word_t))
+			any |= *(word_t *)&dest[i] = *(word_t *)&src[i];
+
+		for (; i<n; i++)
+			any |= dest[i] = src[i];
+	}
+	else
+	{
+		for (i=n; i >= sizeof(word_t); i-=sizeof(word_t))
+			any |= *(word_t *)&dest[i-sizeof(word_t)] = *(word_t *)&src[i-sizeof(word_t)];
+
+		for (; i>0; i--)
+			any |= dest[i-1] = src[i-1];
+	}
+
+	return any;
+}
+
+static void fill_mem(char *dest, unsigned char c, unsigned long n)
+{
+	unsigned long i, w = c * 0x0101010101010101UL;
+
+	for (i=0; i+sizeof(word_t) <= n; i+=sizeof(word_t))
+		*(word_t *)&dest[i] = w;
+
+	for (; i<n; i++)
+		dest[i] = c;
+}
+
+/* bounded strlen, returns -1 if the string runs into memory which is not
+ * known to be readable
+ */
+static long user_strlen(const char *s)
+{
+	unsigned long i;
+
+	if ( !user_readable((unsigned long)s, 1) )
+		return -1;
+
+	for (i=0; s[i] != '\0'; i++)
+		if ( (((unsigned long)&s[i+1] & PG_MASK) == 0) &&
+		     !user_readable((unsigned long)&s[i+1], 1) )
+			return -1;
+
+	return i;
+}
+
+static int can_return(long *regs)
+{
+	unsigned long rsp = regs[REG_ESP];
+
+	if ( !user_readable(rsp, sizeof(long)) )
+		return 0;
+
+	/* let the real ret raise the fault / fire the return hook */
+	return *(unsigned long *)SHADOW(rsp) == 0;
+}
+
+static int summary_return(long *regs, long ret, unsigned long ret_taint)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+	unsigned long *rsp = (unsigned long *)regs[REG_ESP];
+
+	regs[REG_EAX] = ret;
+	set_reg_taint(REG_EAX, ret_taint);
+
+	local_ctx->user_rip = rsp[0];
+	local_ctx->user_rsp = (long)&rsp[1];
+	local_ctx->jit_rip = (long)state_restore;
+	return 0;
+}
+
+static void copy_taint(char *dest, const char *src, unsigned long n)
+{
+	if ( copy_mem(SHADOW(dest), SHADOW(src), n) )
+		taint_summary_mark(dest, n);
+	else
+		taint_summary_clear(dest, n);
+}
+
+static int summary_memmove(long *regs)
+{
+	char *dest = (char *)regs[REG_EDI], *src = (char *)regs[REG_ESI];
+	unsigned long n = regs[REG_EDX];
+
+	if ( !can_return(regs) || !user_writable((unsigned long)dest, n) ||
+	                          !user_readable((unsigned long)src, n) )
+		return 0;
+
+	copy_taint(dest, src, n);
+	copy_mem(dest, src, n);
+
+	return summary_return(regs, (long)dest, get_reg_taint(REG_EDI));
+}
+
+static int summary_mempcpy(long *regs)
+{
+	char *dest = (char *)regs[REG_EDI], *src = (char *)regs[REG_ESI];
+	unsigned long n = regs[REG_EDX];
+
+	if ( !can_return(regs) || !user_writable((unsigned long)dest, n) ||
+	                          !user_readable((unsigned long)src, n) )
+		return 0;
+
+	copy_taint(dest, src, n);
+	copy_mem(dest, src, n);
+
+	return summary_return(regs, (long)dest+n, get_reg_taint(REG_EDI) |
+	                                          get_reg_taint(REG_EDX));
+}
+
+static int summary_memset(long *regs)
+{
+	char *dest = (char *)regs[REG_EDI];
+	int c = regs[REG_ESI];
+	unsigned long n = regs[REG_EDX];
+	unsigned char c_taint = get_reg_taint(REG_ESI);
+
+	if ( !can_return(regs) || !user_writable((unsigned long)dest, n) )
+		return 0;
+
+	fill_mem(SHADOW(dest), c_taint, n);
+	if (c_taint)
+		taint_summary_mark(dest, n);
+	else
+		taint_summary_clear(dest, n);
+
+	fill_mem(dest, c, n);
+
+	return summary_return(regs, (long)dest, get_reg_taint(REG_EDI));
+}
+
+static int summary_strlen(long *regs)
+{
+	char *s = (char *)regs[REG_EDI];
+	long len = user_strlen(s);
+
+	if ( !can_return(regs) || (len < 0) )
+		return 0;
+
+	/* the length is computed from the pointer, not from the data */
+	return summary_return(regs, len, get_reg_taint(REG_EDI));
+}
+
+static int summary_strcpy(long *regs)
+{
+	char *dest = (char *)regs[REG_EDI], *src = (char *)regs[REG_ESI];
+	long len = user_strlen(src);
+
+	if ( !can_return(regs) || (len < 0) ||
+	     !user_writable((unsigned long)dest, len+1) )
+		return 0;
+
+	copy_taint(dest, src, len+1);
+	copy_mem(dest, src, len+1);
+
+	return summary_return(regs, (long)dest, get_reg_taint(REG_EDI));
+}
+
+static int summary_strcmp(long *regs)
+{
+	unsigned char *s1 = (unsigned char *)regs[REG_EDI],
+	              *s2 = (unsigned char *)regs[REG_ESI];
+	long len1 = user_strlen((char *)s1), len2 = user_strlen((char *)s2);
+	unsigned long i;
+
+	if ( !can_return(regs) || (len1 < 0) || (len2 < 0) )
+		return 0;
+
+	for (i=0; (s1[i] == s2[i]) && s1[i]; i++);
+
+	/* the result is the difference of the first mismatching bytes */
+	unsigned char taint = *SHADOW(&s1[i]) | *SHADOW(&s2[i]);
+
+	return summary_return(regs, (long)s1[i]-(long)s2[i], TAINT_LONG(taint));
+}
+
+static struct
+{
+	char *name;
+	hook_func_t func;
+
+} summary_map[] =
+{
+	{ .name = "memcpy",  .func = summary_memmove },
+	{ .name = "memmove", .func = summary_memmove },
+	{ .name = "mempcpy", .func = summary_mempcpy },
+	{ .name = "memset",  .func = summary_memset },
+	{ .name = "strlen",  .func = summary_strlen },
+	{ .name = "strcpy",  .func = summary_strcpy },
+	{ .name = "strcmp",  .func = summary_strcmp },
+	{ .func = NULL },
+};
+
+/* glibc exports these as IFUNCs, the implementations themselves are only
+ * visible in .symtab under names like __memmove_avx_unaligned_erms.
+ * __memcpy_chk and friends take an extra argument, leave those alone.
+ */
+static int summary_name_match(const char *sym, const char *name)
+{
+	unsigned long n = strlen(name);
+
+	if ( strcmp(sym, name) == 0 )
+		return 1;
+
+	return (sym[0] == '_') && (sym[1] == '_') &&
+	       (strncmp(&sym[2], name, n) == 0) && (sym[2+n] == '_') &&
+	       (strncmp(&sym[2+n], "_chk", 4) != 0);
+}
+
+typedef struct
+{
+	unsigned long long inode, dev;
+	unsigned long mtime;
+
+} summary_file_t;
+
+static void add_summary(const char *sym, unsigned long offset,
+                        unsigned long size, void *arg)
+{
+	summary_file_t *f = arg;
+	int i;
+
+	for (i=0; summary_map[i].func; i++)
+		if ( summary_name_match(sym, summary_map[i].name) )
+			register_hook(summary_map[i].func, f->inode, f->dev,
+			              f->mtime, offset);
+}
+
+void register_libc_summaries(int fd, unsigned long long inode,
+                                     unsigned long long dev,
+                                     unsigned long mtime)
+{
+	if ( (fd < 0) || (inode == 0) || (taint_flag == TAINT_OFF) )
+		return;
+
+	summary_file_t f = { .inode = inode, .dev = dev, .mtime = mtime };
+	elf_named_func_symbols(fd, add_summary, &f);
+}
@@ -0,0 +1,29 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ * Copyright 2011 Vrije Universiteit Amsterdam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LIBC_SUMMARY_H
+#define LIBC_SUMMARY_H
+
+extern int libc_summaries;
+
+void register_libc_summaries(int fd, unsigned long long inode,
+                                     unsigned long long dev,
+                                     unsigned long mtime);
+
+#endif /* LIBC_SUMMARY_H */
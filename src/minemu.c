@@ -36,6 +36,9 @@
 #include "opcodes.h"
 #include "threads.h"
 #include "jit_cache.h"
+#include "jit_spec.h"
+#include "taint_code.h"
+#include "taint.h"
 
 /* not called main() to avoid warnings about extra parameters :-(  */
 int minemu_main(int argc, char *orig_argv[], char *envp[], long auxv[])
@@ -50,9 +53,15 @@ int minemu_main(int argc, char *orig_argv[], char *envp[], long auxv[])
 	}
 
 	init_threads();
+	taint_code_init();
 
 	argv = parse_options(argv);
 
+#ifdef TAINT_BITMAP
+	if (taint_flag != TAINT_OFF)
+		die("built with TAINT_BITMAP, which translated code does not use yet, use -notaint");
+#endif
+
 	if ( (progname == NULL) && (argv[0][0] == '/') )
 		progname = argv[0];
 
@@ -61,6 +70,7 @@ int minemu_main(int argc, char *orig_argv[], char *envp[], long auxv[])
 	sigwrap_init();
 	unblock_signals();
 	jit_init();
+	jit_spec_init();
 
 	elf_prog_t prog =
 	{
@@ -20,6 +20,7 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <linux/mman.h>
+#include <linux/memfd.h>
 #include <linux/auxvec.h>
 #include <errno.h>
 
@@ -27,6 +28,10 @@
 #define AT_EXECFN 31
 #endif
 
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+#endif
+
 #include "mm.h"
 #include "error.h"
 #include "lib.h"
@@ -38,6 +43,12 @@
 #include "kernel_compat.h"
 #include "threads.h"
 #include "proc.h"
+#include "jit_spec.h"
+#include "elf_symbols.h"
+#include "taint_summary.h"
+#include "libc_summary.h"
+#include "taint.h"
+#include "vdso.h"
 
 /* switch when shadow shared memory is completely done */
 #define SHADOW_DEFAULT_PROT (PROT_NONE)
@@ -47,6 +58,9 @@ unsigned long vdso, vdso_orig, sysenter_reentry, minemu_stack_bottom, stack_bott
 
 long map_lock;
 
+int use_hugepages = 0;
+int mmap_taint = 0;
+
 static int bad_range(unsigned long addr, size_t length)
 {
 	return (addr > USER_END) || (addr+length > USER_END);
@@ -66,13 +80,126 @@ static long no_exec(long prot)
 	return new_prot;
 }
 
-static void shadow_mmap(unsigned long addr, size_t length, long prot, int fd, off_t pgoffset)
+/* Guest pages which are known to be readable / writable, kept up to date by
+ * the user_* functions below.  Lets minemu code touch guest memory without
+ * risking a fault it cannot hand to the guest (see libc_summary.c).  Pages
+ * the guest got some other way (shmat(), stack growth) are left out, reading
+ * beyond the end of a truncated file mapping is not covered.
+ */
+#define BITS_PER_LONG (sizeof(long)*8)
+
+static unsigned long readable[USER_PAGES/BITS_PER_LONG],
+                     writable[USER_PAGES/BITS_PER_LONG];
+
+static void set_page_bits(unsigned long *map, unsigned long first,
+                          unsigned long end, int val)
 {
-	long ret;
+	unsigned long i = first, mask;
+
+	while (i < end)
+	{
+		if ( (i % BITS_PER_LONG == 0) && (end-i >= BITS_PER_LONG) )
+		{
+			map[i/BITS_PER_LONG] = val ? ~0UL : 0;
+			i += BITS_PER_LONG;
+			continue;
+		}
+
+		/* words shared with neighbouring mappings */
+		mask = 1UL<<(i%BITS_PER_LONG);
+		if (val)
+			__sync_fetch_and_or(&map[i/BITS_PER_LONG], mask);
+		else
+			__sync_fetch_and_and(&map[i/BITS_PER_LONG], ~mask);
+		i++;
+	}
+}
+
+static void set_access(unsigned long addr, size_t length, long prot)
+{
+	unsigned long first = addr/PG_SIZE, end = PAGE_NEXT(addr+length)/PG_SIZE;
+
+	if (end > USER_PAGES)
+		end = USER_PAGES;
+
+	set_page_bits(readable, first, end, !!(prot & (PROT_READ|PROT_WRITE|PROT_EXEC)));
+	set_page_bits(writable, first, end, !!(prot & PROT_WRITE));
+}
+
+static int test_pages(unsigned long *map, unsigned long addr, unsigned long len)
+{
+	unsigned long i, end;
 
+	if ( (addr >= USER_END) || (len > USER_END-addr) )
+		return 0;
+
+	if (len == 0)
+		return 1;
+
+	end = (addr+len-1)/PG_SIZE;
+	for (i=addr/PG_SIZE; i<=end; i++)
+		if ( !((map[i/BITS_PER_LONG] >> (i%BITS_PER_LONG)) & 1) )
+			return 0;
+
+	return 1;
+}
+
+int user_readable(unsigned long addr, unsigned long len)
+{
+	return test_pages(readable, addr, len);
+}
+
+int user_writable(unsigned long addr, unsigned long len)
+{
+	return test_pages(readable, addr, len) && test_pages(writable, addr, len);
+}
+
+static long get_access(unsigned long addr)
+{
+	return (user_readable(addr, 1) ? PROT_READ  : 0) |
+	       (user_writable(addr, 1) ? PROT_WRITE : 0);
+}
+
+/* Ask for transparent huge pages for all 2MB-aligned huge pages within
+ * [addr, addr+length). We cannot move the borders of the region, since
+ * they are dictated by the user's (or the jit allocator's) memory layout.
+ */
+void advise_hugepages(unsigned long addr, size_t length)
+{
+	unsigned long start = HUGE_PAGE_NEXT(addr),
+	              end = HUGE_PAGE_BASE(addr+length);
+
+	if ( use_hugepages && (start < end) )
+		sys_madvise(start, end-start, MADV_HUGEPAGE);
+}
+
+static void hugepage_report_region(int fd, char *name, unsigned long start, unsigned long end)
+{
+	smaps_usage_t u;
+	read_smaps_usage(start, end, &u);
+	fd_printf(fd, "%s: %u kB resident, %u kB in huge pages\n", name, u.rss/1024, u.anon_huge/1024);
+}
+
+void hugepage_report(int fd)
+{
+	if (!use_hugepages)
+		return;
+
+	hugepage_report_region(fd, "shadow memory", TAINT_START, TAINT_END);
+	hugepage_report_region(fd, "jit code", JIT_START, JIT_END);
+}
+
+static void shadow_mmap(unsigned long addr, size_t length, long prot, int fd, off_t pgoffset)
+{
 	if (length == 0)
 		return;
 
+#ifdef TAINT_BITMAP
+	/* the bitmap stays mapped, see init_minemu_mem() */
+	taint_mem((char *)addr, length, TAINT_CLEAR);
+#else
+	long ret;
+
 #ifndef __x86_64__
 	ret = sys_mmap2(addr+TAINT_OFFSET, length, no_exec(prot),
 	                MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS, -1, 0);
@@ -84,6 +211,13 @@ static void shadow_mmap(unsigned long addr, size_t length, long prot, int fd, of
 	if (ret & PG_MASK)
 		die("shadow_m{,un}map(): %08x\n", ret);
 
+	taint_summary_clear((char *)addr, length);
+
+	if (no_exec(prot) != PROT_NONE)
+		advise_hugepages(addr+TAINT_OFFSET, length);
+#endif
+	taint_summary_file_shadow((char *)addr, length, 0);
+
 	if ( (prot & PROT_EXEC) && !(prot & PROT_WRITE) )
 	{
 		struct kernel_stat64 s;
@@ -96,11 +230,64 @@ static void shadow_mmap(unsigned long addr, size_t length, long prot, int fd, of
 
 		add_code_region((char *)addr, PAGE_NEXT(length),
 		                s.st_ino, s.st_dev, s.st_mtime, pgoffset);
+		if ( jit_whole_func && (fd >= 0) )
+			load_func_symbols(fd, s.st_ino, s.st_dev, s.st_mtime);
+		if ( libc_summaries )
+			register_libc_summaries(fd, s.st_ino, s.st_dev, s.st_mtime);
+		jit_spec_queue_symbols(fd, (char *)addr, PAGE_NEXT(length), pgoffset);
 	}
 	else
 		del_code_region((char *)addr, PAGE_NEXT(length));
 }
 
+/* -mmaptaint: the shadow of a mapping of an untrusted file is a private
+ * mapping of a memfd full of TAINT_FILE bytes, repeated every
+ * FILE_TAINT_WINDOW bytes.  The shadow pages share the memfd's page cache
+ * until they are written, so the size of the mapping costs nothing.
+ */
+#define FILE_TAINT_WINDOW (0x100000UL)
+
+static void file_taint_shadow(unsigned long addr, size_t length, long prot)
+{
+	unsigned long shadow = addr+TAINT_OFFSET, off,
+	              window = min(PAGE_NEXT(length), FILE_TAINT_WINDOW);
+	long fd, ret;
+
+	if ( (length == 0) || (no_exec(prot) == PROT_NONE) )
+		return;
+
+#ifdef TAINT_BITMAP
+	taint_mem((char *)addr, length, TAINT_FILE);
+	return;
+#endif
+
+	fd = sys_memfd_create("file_taint", MFD_CLOEXEC);
+	if (fd < 0)
+		return; /* keep the clean shadow */
+
+	ret = sys_ftruncate(fd, window);
+
+	/* fill the memfd through the first window of the shadow itself */
+	if (ret == 0)
+		ret = sys_mmap(shadow, window, PROT_READ|PROT_WRITE,
+		               MAP_SHARED|MAP_FIXED, fd, 0) ^ shadow;
+
+	if (ret == 0)
+		memset((char *)shadow, TAINT_FILE, window);
+
+	for (off=0; (ret == 0) && (off < length); off += window)
+		ret = sys_mmap(shadow+off, min(window, length-off), no_exec(prot),
+		               MAP_PRIVATE|MAP_FIXED, fd, 0) ^ (shadow+off);
+
+	sys_close(fd);
+
+	if (ret)
+		die("file_taint_shadow(): %08x\n", ret);
+
+	taint_summary_mark((char *)addr, length);
+	taint_summary_file_shadow((char *)addr, length, 1);
+}
+
 static void shadow_munmap(unsigned long addr, size_t length)
 {
 	shadow_mmap(addr, length, SHADOW_DEFAULT_PROT, -1, 0);
@@ -110,10 +297,12 @@ static void shadow_munmap(unsigned long addr, size_t length)
  * to handle success.
  */
 static void shadow_mremap(unsigned long old_addr, size_t old_size,
-                          size_t new_size, long _flags, unsigned long new_addr)
+                          size_t new_size, long _flags, unsigned long new_addr,
+                          code_map_t *code)
 {
 	long flags = (old_addr != new_addr) ? MREMAP_MAYMOVE|MREMAP_FIXED : 0;
-	int is_code = !!find_code_map((char *)old_addr);
+	int tainted = taint_summary_any((char *)old_addr, old_size);
+	int file_backed = taint_summary_file_shadow_any((char *)old_addr, old_size);
 
 	if (new_addr < old_addr)
 		shadow_munmap(new_addr, min(old_addr-new_addr, new_size));
@@ -122,6 +311,7 @@ static void shadow_mremap(unsigned long old_addr, size_t old_size,
 		if (flags)
 			shadow_munmap(max(new_addr, old_addr+old_size),
 			              min(new_size, new_addr+new_size-old_addr-old_size));
+#ifndef TAINT_BITMAP
 		else if (new_size != old_size)
 		{
 			mutex_lock(&map_lock); /* make sure user_mmap2() will not return memory
@@ -129,9 +319,11 @@ static void shadow_mremap(unsigned long old_addr, size_t old_size,
 			                        */
 			sys_munmap(old_addr+old_size+TAINT_OFFSET, new_size-old_size);
 		}
+#endif
 
 	if ( (new_addr != old_addr) || (new_size != old_size) )
 	{
+#ifndef TAINT_BITMAP
 		long ret = sys_mremap(old_addr+TAINT_OFFSET, old_size, new_size, flags,
 		                      new_addr+TAINT_OFFSET);
 
@@ -142,11 +334,27 @@ static void shadow_mremap(unsigned long old_addr, size_t old_size,
 
 		if (ret & PG_MASK)
 			die("shadow_mremap(): %08x\n", ret);
+#else
+		taint_move((char *)new_addr, (char *)old_addr, min(old_size, new_size));
+		if (new_size > old_size)
+			taint_mem((char *)new_addr+old_size, new_size-old_size, TAINT_CLEAR);
+#endif
 
-		if (is_code)
-			add_code_region((char *)new_addr, PAGE_NEXT(new_size), 0, 0, 0, 0);
-		else
-			del_code_region((char *)new_addr, PAGE_NEXT(new_size));
+		if (tainted)
+			taint_summary_mark((char *)new_addr, new_size);
+
+		if (file_backed)
+			taint_summary_file_shadow((char *)new_addr, new_size, 1);
+
+		/* the memfd ends with the last window, the grown part would SIGBUS */
+		if ( file_backed && (new_size > old_size) )
+			file_taint_shadow(new_addr+old_size, new_size-old_size, PROT_READ|PROT_WRITE);
+
+		/* user_mremap() has dropped the old and new code regions already */
+		if (code)
+			add_code_region((char *)new_addr, PAGE_NEXT(new_size),
+			                code->inode, code->dev, code->mtime, code->pgoffset +
+			                (old_addr-(unsigned long)code->addr)/PG_SIZE);
 	}
 
 	if (old_addr < new_addr)
@@ -239,6 +447,10 @@ unsigned long user_mmap(unsigned long addr, size_t length, int prot,
 		return -EFAULT;
 	}
 
+	/* keep the speculative translator off code we may map over */
+	if (flags & MAP_FIXED)
+		mutex_lock(&jit_lock);
+
 	/* shadow_mremap() might temporarily leave holes in shadow memory
 	 * make sure we won't get this memory.
 	 */
@@ -252,8 +464,23 @@ unsigned long user_mmap(unsigned long addr, size_t length, int prot,
 #endif
 	mutex_unlock(&map_lock);
 
+	if (flags & MAP_FIXED)
+	{
+		if ( !(ret & PG_MASK) )
+			del_code_region_locked((char *)ret, PAGE_NEXT(length));
+
+		mutex_unlock(&jit_lock);
+	}
+
 	if ( !(ret & PG_MASK) )
+	{
 		shadow_mmap(ret, length, prot, fd, pgoffset);
+		set_access(ret, length, prot);
+	}
+
+	if ( !(ret & PG_MASK) && mmap_taint && !(flags & MAP_ANONYMOUS) &&
+	     !(prot & PROT_EXEC) && (fd >= 0) && (taint_val(fd) == TAINT_FILE) )
+		file_taint_shadow(ret, length, prot);
 
 	if ( (prot & PROT_WRITE) && (prot & PROT_EXEC) )
 		debug("Minemu warning: RWX memory map: "
@@ -268,10 +495,20 @@ unsigned long user_munmap(unsigned long addr, size_t length)
 	if ( bad_range(addr, length) )
 		return -EFAULT;
 
+	/* keep the speculative translator off the code while it goes away */
+	mutex_lock(&jit_lock);
 	unsigned long ret = sys_munmap(addr, length);
 
 	if ( !(ret & PG_MASK) )
+		del_code_region_locked((char *)addr, PAGE_NEXT(length));
+
+	mutex_unlock(&jit_lock);
+
+	if ( !(ret & PG_MASK) )
+	{
+		set_access(addr, length, PROT_NONE);
 		shadow_munmap(addr, PAGE_NEXT(length));
+	}
 
 	return ret;
 }
@@ -281,17 +518,34 @@ unsigned long user_mprotect(unsigned long addr, size_t length, long prot)
 	if ( bad_range(addr, length) )
 		return -EFAULT;
 
+	int to_code = (prot & PROT_EXEC) && !(prot & PROT_WRITE);
+
+	/* keep the speculative translator off code which may become unreadable */
+	if (!to_code)
+		mutex_lock(&jit_lock);
+
+	set_access(addr, length, PROT_NONE);
+
 	unsigned long ret = sys_mprotect(addr, length, no_exec(prot));
+#ifndef TAINT_BITMAP
 	                    sys_mprotect(TAINT_OFFSET+addr, length, no_exec(prot));
+#endif
 
-	if ( !(ret & PG_MASK) )
+	if (!to_code)
 	{
-		if ( (prot & PROT_EXEC) && !(prot & PROT_WRITE) )
-			add_code_region((char *)addr, PAGE_NEXT(length), 0, 0, 0, 0);
-		else
-			del_code_region((char *)addr, PAGE_NEXT(length));
+		if ( !(ret & PG_MASK) )
+			del_code_region_locked((char *)addr, PAGE_NEXT(length));
+
+		mutex_unlock(&jit_lock);
 	}
 
+	/* a failed call may have changed part of the range, leave it unknown */
+	if ( !(ret & PG_MASK) )
+		set_access(addr, length, prot);
+
+	if ( !(ret & PG_MASK) && to_code )
+		add_code_region((char *)addr, PAGE_NEXT(length), 0, 0, 0, 0);
+
 	return ret;
 }
 
@@ -303,7 +557,14 @@ unsigned long user_madvise(unsigned long addr, size_t length, long advise)
 	unsigned long ret = sys_madvise(addr, length, advise);
 
 	if (!ret && advise == MADV_DONTNEED)
+	{
+#ifndef TAINT_BITMAP
 		sys_madvise(TAINT_OFFSET+addr, length, advise);
+		taint_summary_clear((char *)addr, length);
+#else
+		taint_mem((char *)addr, length, TAINT_CLEAR);
+#endif
+	}
 
 	return ret;
 }
@@ -328,11 +589,29 @@ unsigned long user_mremap(unsigned long old_addr, size_t old_size,
 
 	if ( (flags & MREMAP_FIXED) && bad_range(new_addr, new_size) )
 		return -ENOMEM;
-	
+
+	code_map_t code;
+	int is_code = get_code_map((char *)old_addr, &code);
+	long prot = get_access(old_addr);
+
+	/* keep the speculative translator off the old range while it goes away */
+	mutex_lock(&jit_lock);
 	unsigned long ret = sys_mremap(old_addr, old_size, new_size, flags, new_addr);
 
+	if ( !(ret & PG_MASK) && ( (ret != old_addr) || (new_size != old_size) ) )
+	{
+		del_code_region_locked((char *)old_addr, PAGE_NEXT(old_size));
+		del_code_region_locked((char *)ret, PAGE_NEXT(new_size));
+	}
+
+	mutex_unlock(&jit_lock);
+
 	if (! (ret & PG_MASK) )
-		shadow_mremap(old_addr, old_size, new_size, flags, ret);
+	{
+		set_access(old_addr, old_size, PROT_NONE);
+		shadow_mremap(old_addr, old_size, new_size, flags, ret, is_code ? &code : NULL);
+		set_access(ret, new_size, prot);
+	}
 
 	return ret;
 }
@@ -348,6 +627,7 @@ static void copy_vdso(unsigned long addr, unsigned long orig)
 		die("connot alloc vdso", ret);
 
 	memcpy((char *)vdso, (char *)vdso_orig, 0x1000);
+	vdso_time_init((char *)vdso, 0x1000, (char *)vdso_orig);
 
 	long off = memscan((char *)vdso, 0x1000, "\x5d\x5a\x59\xc3", 4);
 
@@ -27,6 +27,12 @@
 #define PAGE_BASE(a) ((long)(a)&~PG_MASK)
 #define PAGE_NEXT(a) (PAGE_BASE((a)-1UL)+PG_SIZE)
 
+#define HUGE_PG_SIZE (0x200000UL)
+#define HUGE_PG_MASK (HUGE_PG_SIZE-1)
+
+#define HUGE_PAGE_BASE(a) ((long)(a)&~HUGE_PG_MASK)
+#define HUGE_PAGE_NEXT(a) (HUGE_PAGE_BASE((a)-1UL)+HUGE_PG_SIZE)
+
 #define HIGH_PAGE (0x100000UL)
 //#define USER_PAGES ( (HIGH_PAGE) /3 )
 #define USER_PAGES ( 0x50000 )
@@ -62,6 +68,12 @@ extern char minemu_end[], minemu_code_start[], minemu_code_end[];
 
 extern unsigned long vdso, vdso_orig, sysenter_reentry, minemu_stack_bottom, stack_bottom;
 
+extern int use_hugepages;
+extern int mmap_taint;
+
+void advise_hugepages(unsigned long addr, size_t length);
+void hugepage_report(int fd);
+
 void init_minemu_mem(long auxv[], char *envp[]);
 
 unsigned long set_brk_min(unsigned long brk);
@@ -100,6 +112,9 @@ unsigned long user_mremap(unsigned long old_addr, size_t old_size,
 
 unsigned long user_shmat(int shmid, char *shmaddr, int shmflg, unsigned long *raddr);
 
+int user_readable(unsigned long addr, unsigned long len);
+int user_writable(unsigned long addr, unsigned long len);
+
 void shield(void);
 void unshield(void);
 
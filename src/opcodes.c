@@ -64,13 +64,8 @@
 #define MW (MODRM|IMMW)
 #define ML (MODRM|IMML)
 
-#define REX_W 8
-#define REX_R 4
-#define REX_X 2
-#define REX_B 1
-
-// TODO: for amd64, PR is added and 0x63 becomes valid, there are also many
-// invalid insts not set as invalid, to make future merge less painful
+// TODO: for amd64, there are many invalid insts not set as invalid,
+// to make future merge less painful
 static const unsigned char optable[] =
 {
 	[MAIN_OPTABLE] =
@@ -81,7 +76,7 @@ static const unsigned char optable[] =
 /* 3? */  M , M , M , M , OB, OW, P2, O , M , M , M , M , OB, OW, P2, O ,
 /* 4? */  PR, PR, PR, PR, PR, PR, PR, PR, PR, PR, PR, PR, PR, PR, PR, PR,
 /* 5? */  O , O , O , O , O , O , O , O , O , O , O , O , O , O , O , O ,
-/* 6? */  O , O , I , I , P2, P2, P3, P4, OW, MW, OB, MB, I , I , I , I ,
+/* 6? */  O , O , I , M , P2, P2, P3, P4, OW, MW, OB, MB, I , I , I , I ,
 /* 7? */  OB, OB, OB, OB, OB, OB, OB, OB, OB, OB, OB, OB, OB, OB, OB, OB,
 /* 8? */  MB, MW, MB, MB, M , M , M , M , M , M , M , M , M , M , M , M ,
 /* 9? */  O , O , O , O , O , O , O , O , O , O , OL, O , O , O , O , O ,
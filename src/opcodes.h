@@ -19,8 +19,9 @@
 #ifndef OPCODES_H
 #define OPCODES_H
 
-#define CPUID_FEATURE_INFO_ECX_MASK (0xc007cdec)
-#define CPUID_FEATURE_INFO_EDX_MASK (0xf87fffff)
+/* SSE up to SSSE3 is emulated (see generate_sse()), no MMX/FXSR/XSAVE/AVX */
+#define CPUID_FEATURE_INFO_ECX_MASK (0xc007cfed)
+#define CPUID_FEATURE_INFO_EDX_MASK (0xfe7fffff)
 
 #ifndef __ASSEMBLER__
 
@@ -38,6 +39,11 @@
 #define BAD_OP       (0x418)
 #define CUTOFF_OP    (0x419)
 
+#define REX_W 8
+#define REX_R 4
+#define REX_X 2
+#define REX_B 1
+
 typedef struct
 {
 	char *addr;
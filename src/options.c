@@ -25,12 +25,21 @@
 #include "jit_cache.h"
 #include "taint_dump.h"
 #include "jit_code.h"
+#include "taint_code.h"
 #include "taint.h"
 #include "sigwrap.h"
 #include "threads.h"
+#include "mm.h"
+#include "jit_spec.h"
+#include "jit.h"
+#include "taint_summary.h"
+#include "libc_summary.h"
 
 char *progname = NULL;
 
+static char funcwindow_buf[24];
+static char reclaim_buf[24];
+
 static void load_sigset(char *sigset_buf)
 {
 	if (strlen(sigset_buf) < 16)
@@ -76,13 +85,49 @@ void usage(char *arg0)
 	"\n"
 	"  -taint              Turn on tainting. (default)\n"
 	"  -notaint            Turn off tainting.\n"
+	"  -dualtaint          Run uninstrumented code until the first taint source\n"
+	"                      fires, then switch to tainting. Arguments and the\n"
+	"                      environment are not tainted in this mode.\n"
+	"  -noavx              Use SSE4.1 encodings for taint propagation, even when\n"
+	"                      the cpu supports AVX. (default: use AVX if available)\n"
+	"\n"
+	"  -reclaim SECONDS    Every SECONDS, give shadow memory which holds no\n"
+	"                      taint back to the kernel.\n"
+	"  -noreclaim          Keep shadow memory resident. (default)\n"
+	"\n"
+	"  -hugepages          Back jit code and shadow memory with transparent\n"
+	"                      huge pages where possible.\n"
+	"  -nohugepages        Use normal pages only. (default)\n"
+	"\n"
+	"  -speculate          Translate likely jump targets and library functions\n"
+	"                      ahead of time in a helper thread.\n"
+	"  -nospeculate        Only translate code when it is reached. (default)\n"
+	"\n"
+	"  -lazysignals        Deliver asynchronous signals at the next indirect jump,\n"
+	"                      backward jump or syscall, instead of finishing the\n"
+	"                      interrupted instruction right away.\n"
+	"  -nolazysignals      Deliver signals immediately. (default)\n"
+	"\n"
+	"  -wholefunc          Translate complete functions (using ELF symbol sizes)\n"
+	"                      and jump table targets when a function is first entered.\n"
+	"  -nowholefunc        Only translate code reachable by relative jumps. (default)\n"
+	"  -funcwindow BYTES   Without symbol information, translate BYTES of code\n"
+	"                      from the entry point. (implies -wholefunc)\n"
 	"\n"
 	"  -trackfiles         Taint files which are not in known executable locations\n"
 	"  -trusteddirs DIRS   Trust (executable) files from these colon-separated\n"
 	"                      locations (implies -trackfiles.) default dirs:\n"
 	"                      '%s'\n"
+	"  -mmaptaint          Also taint memory mappings of untrusted files, shadow\n"
+	"                      pages are filled on first access.\n"
+	"                      (implies -trackfiles)\n"
+	"  -nommaptaint        Only taint data read() from untrusted files. (default)\n"
 	"\n"
 	"  -hooks HOOKLIST     Use specialised hooks XXX TODO XXX\n"
+	"  -libcsummary        Run memcpy/memmove/memset/strlen/strcpy/strcmp from\n"
+	"                      mapped libraries natively, copying the taint along.\n"
+	"  -nolibcsummary      Emulate these functions instruction by instruction.\n"
+	"                      (default)\n"
 	"\n"
 	"  -help               Show this message and exit.\n"
 	"  -version            Print version number and exit.\n",
@@ -131,9 +176,47 @@ char **parse_options(char **argv)
 		else if ( strcmp(*argv, "-lazy") == 0 )
 			call_strategy = LAZY_CALL;
 		else if ( strcmp(*argv, "-taint") == 0 )
+		{
 			taint_flag = TAINT_ON;
+			taint_dual = 0;
+		}
 		else if ( strcmp(*argv, "-notaint") == 0 )
+		{
 			taint_flag = TAINT_OFF;
+			taint_dual = 0;
+		}
+		else if ( strcmp(*argv, "-dualtaint") == 0 )
+		{
+			taint_flag = TAINT_CLEAN;
+			taint_dual = 1;
+		}
+		else if ( strcmp(*argv, "-noavx") == 0 )
+			taint_vex = 0;
+		else if ( strcmp(*argv, "-reclaim") == 0 )
+			taint_reclaim_interval = numread(*++argv);
+		else if ( strcmp(*argv, "-noreclaim") == 0 )
+			taint_reclaim_interval = 0;
+		else if ( strcmp(*argv, "-hugepages") == 0 )
+			use_hugepages = 1;
+		else if ( strcmp(*argv, "-nohugepages") == 0 )
+			use_hugepages = 0;
+		else if ( strcmp(*argv, "-speculate") == 0 )
+			jit_speculate = 1;
+		else if ( strcmp(*argv, "-nospeculate") == 0 )
+			jit_speculate = 0;
+		else if ( strcmp(*argv, "-lazysignals") == 0 )
+			lazy_signals = 1;
+		else if ( strcmp(*argv, "-nolazysignals") == 0 )
+			lazy_signals = 0;
+		else if ( strcmp(*argv, "-wholefunc") == 0 )
+			jit_whole_func = 1;
+		else if ( strcmp(*argv, "-nowholefunc") == 0 )
+			jit_whole_func = 0;
+		else if ( strcmp(*argv, "-funcwindow") == 0 )
+		{
+			jit_whole_func = 1;
+			jit_func_window = numread(*++argv);
+		}
 		else if ( strcmp(*argv, "-dumponexit") == 0 )
 			dump_on_exit = 1;
 		else if ( strcmp(*argv, "-nodumponexit") == 0 )
@@ -146,6 +229,18 @@ char **parse_options(char **argv)
 			trusted_dirs = trusted_dirs_default;
 		else if ( strcmp(*argv, "-trusteddirs") == 0 )
 			set_trusted_dirs(*++argv);
+		else if ( strcmp(*argv, "-mmaptaint") == 0 )
+		{
+			mmap_taint = 1;
+			if (!trusted_dirs)
+				trusted_dirs = trusted_dirs_default;
+		}
+		else if ( strcmp(*argv, "-nommaptaint") == 0 )
+			mmap_taint = 0;
+		else if ( strcmp(*argv, "-libcsummary") == 0 )
+			libc_summaries = 1;
+		else if ( strcmp(*argv, "-nolibcsummary") == 0 )
+			libc_summaries = 0;
 		else if ( strcmp(*argv, "-hooks") == 0 )
 		{
 			if (parse_hooklist(*++argv) < 0)
@@ -171,6 +266,16 @@ long option_args_count(void)
 	       (dump_all                              ? 1 : 0) +
 	       (call_strategy != PRESEED_ON_CALL      ? 1 : 0) +
 	       (taint_flag == TAINT_OFF               ? 1 : 0) +
+	       (taint_dual                            ? 1 : 0) +
+	       (!taint_vex                            ? 1 : 0) +
+	       (taint_reclaim_interval                ? 2 : 0) +
+	       (use_hugepages                         ? 1 : 0) +
+	       (jit_speculate                         ? 1 : 0) +
+	       (lazy_signals                          ? 1 : 0) +
+	       (jit_whole_func                        ? 1 : 0) +
+	       (jit_func_window                       ? 2 : 0) +
+	       (libc_summaries                        ? 1 : 0) +
+	       (mmap_taint                            ? 1 : 0) +
 	       (trusted_dirs                          ? 1 : 0) +
 	       (trusted_dirs != trusted_dirs_default  ? 1 : 0) +
 	       1; /* -- */
@@ -209,6 +314,60 @@ char **option_args_setup(char **argv, char *filename, char *sigset_buf)
 		argv[i] = "-notaint";
 		i++;
 	}
+	if ( taint_dual )
+	{
+		argv[i] = "-dualtaint";
+		i++;
+	}
+	if ( !taint_vex )
+	{
+		argv[i] = "-noavx";
+		i++;
+	}
+	if ( taint_reclaim_interval )
+	{
+		reclaim_buf[0] = '\0';
+		argv[i  ] = "-reclaim";
+		argv[i+1] = numcat(reclaim_buf, taint_reclaim_interval);
+		i += 2;
+	}
+	if ( use_hugepages )
+	{
+		argv[i] = "-hugepages";
+		i++;
+	}
+	if ( jit_speculate )
+	{
+		argv[i] = "-speculate";
+		i++;
+	}
+	if ( lazy_signals )
+	{
+		argv[i] = "-lazysignals";
+		i++;
+	}
+	if ( jit_whole_func )
+	{
+		argv[i] = "-wholefunc";
+		i++;
+	}
+	if ( jit_func_window )
+	{
+		funcwindow_buf[0] = '\0';
+		argv[i  ] = "-funcwindow";
+		argv[i+1] = numcat(funcwindow_buf, jit_func_window);
+		i += 2;
+	}
+	if ( libc_summaries )
+	{
+		argv[i] = "-libcsummary";
+		i++;
+	}
+	if ( mmap_taint )
+	{
+		argv[i] = "-mmaptaint";
+		i++;
+	}
 	if ( dump_on_exit )
 	{
 		argv[i] = "-dumponexit";
@@ -88,16 +88,21 @@ static int map_getc(map_file_t *f)
 	return (!map_eof(f)) ? f->buf[f->i++] : -1;
 }
 
-int open_maps(map_file_t *f)
+static int open_proc_file(map_file_t *f, char *filename)
 {
-	*f = (map_file_t) { .fd = sys_open("/proc/self/maps", O_RDONLY, 0), };
+	*f = (map_file_t) { .fd = sys_open(filename, O_RDONLY, 0), };
 
 	if (f->fd < 0)
-		die("could not open /proc/self/maps");
+		die("could not open %s", filename);
 
 	return f->fd;
 }
 
+int open_maps(map_file_t *f)
+{
+	return open_proc_file(f, "/proc/self/maps");
+}
+
 int close_maps(map_file_t *f)
 {
 	return sys_close(f->fd);
@@ -141,3 +146,61 @@ int read_map(map_file_t *f, map_entry_t *e)
 	return 1;
 }
 
+/* /proc/self/smaps, only used for statistics */
+
+static int read_line(map_file_t *f, char *buf, long size)
+{
+	long i=0;
+	int c;
+
+	while ( ((c=map_getc(f)) > 0) && (c != '\n') )
+		if (i < size-1)
+			buf[i++] = c;
+
+	buf[i] = '\0';
+	return (c > 0) || (i > 0);
+}
+
+static unsigned long smaps_bytes(char *line)
+{
+	unsigned long kb = 0;
+
+	line = strchr(line, ':')+1;
+	while (*line == ' ')
+		line++;
+
+	for (; *line >= '0' && *line <= '9'; line++)
+		kb = kb*10 + *line-'0';
+
+	return kb*1024;
+}
+
+/* sums the resident and the huge page backed memory of all mappings
+ * which start inside [start, end)
+ */
+void read_smaps_usage(unsigned long start, unsigned long end, smaps_usage_t *u)
+{
+	map_file_t f;
+	char line[256];
+	int in_range = 0;
+
+	*u = (smaps_usage_t) { .rss = 0, };
+	open_proc_file(&f, "/proc/self/smaps");
+
+	while (read_line(&f, line, sizeof(line)))
+	{
+		if ( (unsigned int)(line[0]-'0') < 10 || (unsigned int)(line[0]-'a') < 6 )
+		{
+			unsigned long addr = strtohexull(line, NULL);
+			in_range = (addr >= start) && (addr < end);
+		}
+		else if (!in_range)
+			continue;
+		else if (strncmp(line, "Rss:", 4) == 0)
+			u->rss += smaps_bytes(line);
+		else if (strncmp(line, "AnonHugePages:", 14) == 0)
+			u->anon_huge += smaps_bytes(line);
+	}
+
+	close_maps(&f);
+}
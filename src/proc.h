@@ -41,4 +41,12 @@ int open_maps(map_file_t *f);
 int read_map(map_file_t *f, map_entry_t *e);
 int close_maps(map_file_t *f);
 
+typedef struct
+{
+	unsigned long rss, anon_huge;
+
+} smaps_usage_t;
+
+void read_smaps_usage(unsigned long start, unsigned long end, smaps_usage_t *u);
+
 #endif /* PROC_H */
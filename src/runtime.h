@@ -36,6 +36,7 @@ long reloc_runtime_ijmp(void);
 long int80_emu(void);
 long linux_sysenter_emu(void);
 long linux_syscall_emu(void);
+long linux_syscall_direct(void);
 long cpuid_emu(void);
 
 extern char syscall_intr_critical_start[], syscall_intr_critical_end[],
@@ -43,6 +43,8 @@
  * atomic when executed natively
  */
 
+int lazy_signals = 0;
+
 /* for the emulation of some some non-blocking syscalls, we block all signals
  *
  */
@@ -74,6 +76,75 @@ void unblock_signals(void)
 	             sizeof(kernel_sigset_t),0,0);
 }
 
+/* The cheap version of try_block_signals() / unblock_signals(), for the
+ * emulation of non-blocking syscalls which can be interrupted but not
+ * re-entered.  Signals arriving in between are kept by sigwrap_handler(),
+ * which returns into the emulator with all signals blocked.  The signal is
+ * queued again when the section ends.  No syscalls unless a signal arrives.
+ */
+int try_defer_signals(void)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+
+	local_ctx->signals_deferred = 1;
+
+	/* finishing the emulator code for a signal in progress, back out,
+	 * syscall_intr() marks the syscall for a restart
+	 */
+	if (local_ctx->jit_fragment_running)
+	{
+		local_ctx->signals_deferred = 0;
+		return !syscall_intr(__NR_getpid,0,0,0,0,0,0);
+	}
+
+	return 1;
+}
+
+/* try_defer_signals() for emulator code called from translated code, such as
+ * the return hooks, which has no syscall to back out of.  When it runs inside
+ * jit_fragment(), the handler's mask keeps all signals blocked anyway.
+ */
+void defer_signals(void)
+{
+	get_thread_ctx()->signals_deferred = 1;
+}
+
+void undefer_signals(void)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+	int sig;
+
+	local_ctx->signals_deferred = 0;
+
+	if (local_ctx->deferred_sig == 0)
+		return;
+
+	sig = local_ctx->deferred_sig;
+	local_ctx->deferred_sig = 0;
+
+	if (local_ctx->deferred_info.si_signo == sig)
+		sys_rt_tgsigqueueinfo(sys_getpid(), sys_gettid(), sig, &local_ctx->deferred_info);
+	else
+		sys_tgkill(sys_getpid(), sys_gettid(), sig);
+
+	unblock_signals(); /* delivered right here */
+}
+
+/* A signal kept back by delay_signal() has to be taken before the emulator
+ * runs a guest syscall.  It arrives right here, so the rest of syscall_emu()
+ * gets finished in fragment mode and the syscall is restarted.
+ */
+void deliver_delayed_signal(void)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+
+	local_ctx->sig_pending = 0;
+	syscall4(__NR_rt_sigprocmask, SIG_SETMASK,
+	         (long)&local_ctx->lazy_sigset,
+	         (long)NULL,
+	         sizeof(kernel_sigset_t));
+}
+
 #ifndef SA_RESTORER
 #define SA_RESTORER        (0x04000000)
 #endif
@@ -144,6 +215,58 @@ static void rt_sigframe_patch_pointers(struct kernel_rt_sigframe *new,
 	new->uc.uc_stack = get_thread_ctx()->altstack;
 }
 
+/* The guest's %xmm3-%xmm7 live in thread_ctx_t (see generate_sse()), the
+ * handler should find them in its frame, and get them back on sigreturn.
+ * At delivery our %xmm3-%xmm5 are dead scratch registers, but %xmm6/%xmm7
+ * hold the register taint, which sigreturn has to restore.  Those are kept
+ * in thread_ctx_t, out of the guest's reach, under the address of the
+ * frame's fpstate.  Frames a handler left with longjmp() are dropped by the
+ * next sigreturn to an outer frame, or as the oldest when too many nest.
+ */
+static void export_guest_xmm(struct _fpstate *fpstate)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+	sig_taint_t *saved;
+
+	if (!fpstate)
+		return;
+
+	if (local_ctx->sig_taint_depth == MAX_SIG_TAINT)
+	{
+		memmove(&local_ctx->sig_taint[0], &local_ctx->sig_taint[1],
+		        (MAX_SIG_TAINT-1)*sizeof(sig_taint_t));
+		local_ctx->sig_taint_depth--;
+	}
+
+	saved = &local_ctx->sig_taint[local_ctx->sig_taint_depth++];
+	saved->fpstate = (unsigned long)fpstate;
+	memcpy(saved->taint_xmm, &fpstate->_xmm[6], sizeof(saved->taint_xmm));
+	memcpy(&fpstate->_xmm[3], local_ctx->guest_xmm, sizeof(local_ctx->guest_xmm));
+}
+
+static void import_guest_xmm(struct _fpstate *fpstate)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+	long i = local_ctx->sig_taint_depth;
+
+	if (!fpstate)
+		return;
+
+	memcpy(local_ctx->guest_xmm, &fpstate->_xmm[3], sizeof(local_ctx->guest_xmm));
+
+	while ( (i > 0) && (local_ctx->sig_taint[i-1].fpstate != (unsigned long)fpstate) )
+		i--;
+
+	if (i > 0)
+	{
+		memcpy(&fpstate->_xmm[6], local_ctx->sig_taint[i-1].taint_xmm,
+		       sizeof(local_ctx->sig_taint[0].taint_xmm));
+		local_ctx->sig_taint_depth = i-1;
+	}
+	else /* not a frame we delivered, don't take the guest's values as taint */
+		memset(&fpstate->_xmm[6], 0, 2*sizeof(fpstate->_xmm[0]));
+}
+
 static void *copy_frame_to_user(void *frame, struct kernel_sigaction *action,
                                              struct sigcontext *context)
 {
@@ -168,6 +291,7 @@ static struct kernel_rt_sigframe *copy_rt_sigframe_to_user(struct kernel_rt_sigf
 {
 	struct kernel_rt_sigframe *copy = copy_frame_to_user(frame, action, &frame->uc.uc_mcontext);
 	rt_sigframe_patch_pointers(copy, frame);
+	export_guest_xmm(copy->uc.uc_mcontext.fpstate);
 
 	if (contains((char *)vdso_orig, 0x1000, copy->pretcode))
 		copy->pretcode += vdso - vdso_orig;
@@ -183,6 +307,7 @@ static struct kernel_sigframe *copy_sigframe_to_user(struct kernel_sigframe *fra
 {
 	struct kernel_sigframe *copy = copy_frame_to_user(frame, action, &frame->sc);
 	sigframe_patch_pointers(copy, frame);
+	export_guest_xmm(copy->sc.fpstate);
 
 	if (contains((char *)vdso_orig, 0x1000, copy->pretcode))
 		copy->pretcode += vdso - vdso_orig;
@@ -219,6 +344,92 @@ static void dump_on_error(int sig, struct sigcontext *context)
 	}
 }
 
+static void sigwrap_handler(int sig, siginfo_t *info, void *_);
+
+static int is_fault_signal(int sig)
+{
+	return (sig == SIGSEGV) || (sig == SIGBUS) || (sig == SIGILL) ||
+	       (sig == SIGFPE)  || (sig == SIGTRAP);
+}
+
+/* the kernel has reset a SA_ONESHOT handler already, the next delivery is the real one */
+static void rearm_wrapper(int sig)
+{
+	struct kernel_sigaction wrap = get_thread_ctx()->sighandler->sigaction_list[sig];
+
+	if ( wrap.flags & SA_ONESHOT )
+	{
+		wrap.handler = sigwrap_handler;
+		wrap.flags |= SA_ONSTACK;
+		wrap.flags &=~ ( SA_NODEFER | SA_RESTORER );
+		memset(&wrap.mask, 0xff, sizeof(wrap.mask));
+		sys_rt_sigaction(sig, &wrap, NULL, sizeof(kernel_sigset_t));
+	}
+}
+
+/* a signal arrived inside a try_defer_signals() section: keep it for
+ * undefer_signals() and return into the emulator with everything blocked
+ */
+static void defer_signal(int sig, siginfo_t *info,
+                         unsigned long *sigmask, unsigned long *extramask)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+
+	local_ctx->deferred_sig = sig;
+	if (info)
+		local_ctx->deferred_info = *info;
+	else
+		local_ctx->deferred_info.si_signo = 0;
+
+	local_ctx->old_sigset.bitmask[0] = *sigmask;
+	*sigmask = ~0UL;
+#ifndef __x86_64__
+	local_ctx->old_sigset.bitmask[1] = *extramask;
+	*extramask = ~0UL;
+#endif
+
+	rearm_wrapper(sig);
+}
+
+#define SIGBIT(sig) (1UL << ((sig)-1))
+#define FAULT_SIGNALS ( SIGBIT(SIGSEGV) | SIGBIT(SIGBUS) | SIGBIT(SIGILL) | \
+                        SIGBIT(SIGFPE)  | SIGBIT(SIGTRAP) )
+
+/* -lazysignals: an asynchronous signal which comes in halfway a translated
+ * instruction is not finished with jit_fragment().  It is queued again and
+ * kept blocked until the next dispatch (jit_return), back edge or syscall,
+ * where it is delivered at an instruction boundary.
+ */
+static void delay_signal(int sig, siginfo_t *info,
+                         unsigned long *sigmask, unsigned long *extramask)
+{
+	thread_ctx_t *local_ctx = get_thread_ctx();
+
+	local_ctx->lazy_sigset.bitmask[0] = *sigmask;
+	*sigmask |= ~FAULT_SIGNALS;
+#ifndef __x86_64__
+	local_ctx->lazy_sigset.bitmask[1] = *extramask;
+	*extramask = ~0UL;
+#endif
+
+	rearm_wrapper(sig);
+
+	if (info)
+		sys_rt_tgsigqueueinfo(sys_getpid(), sys_gettid(), sig, info);
+	else
+		sys_tgkill(sys_getpid(), sys_gettid(), sig);
+
+	local_ctx->sig_pending = 1;
+}
+
+static int inside_jit_op(char *rip)
+{
+	char *jit_op_start;
+	long jit_op_len;
+
+	return jit_rev_lookup_addr(rip, &jit_op_start, &jit_op_len) && (rip != jit_op_start);
+}
+
 static void sigwrap_handler(int sig, siginfo_t *info, void *_)
 {
 	thread_ctx_t *local_ctx = get_thread_ctx();
@@ -228,6 +439,36 @@ static void sigwrap_handler(int sig, siginfo_t *info, void *_)
 	struct sigcontext *context;
 	unsigned long *sigmask, *extramask;
 
+	/* no lock, the deferring code may hold it */
+	if ( local_ctx->signals_deferred && !is_fault_signal(sig) )
+	{
+		if ( local_ctx->sighandler->sigaction_list[sig].flags & SA_SIGINFO )
+			defer_signal(sig, info, &rt_sigframe->uc.uc_sigmask.bitmask[0],
+			                        &rt_sigframe->uc.uc_sigmask.bitmask[1]);
+		else
+			defer_signal(sig, NULL, &sigframe->sc.oldmask, &sigframe->extramask[0]);
+		return;
+	}
+
+	if ( lazy_signals && (taint_flag != TAINT_CLEAN) && !is_fault_signal(sig) &&
+	     !local_ctx->jit_fragment_running )
+	{
+		if ( local_ctx->sighandler->sigaction_list[sig].flags & SA_SIGINFO )
+		{
+			if ( inside_jit_op((char *)rt_sigframe->uc.uc_mcontext.rip) )
+			{
+				delay_signal(sig, info, &rt_sigframe->uc.uc_sigmask.bitmask[0],
+				                        &rt_sigframe->uc.uc_sigmask.bitmask[1]);
+				return;
+			}
+		}
+		else if ( inside_jit_op((char *)sigframe->sc.rip) )
+		{
+			delay_signal(sig, NULL, &sigframe->sc.oldmask, &sigframe->extramask[0]);
+			return;
+		}
+	}
+
 	siglock(local_ctx);
 	struct kernel_sigaction action = local_ctx->sighandler->sigaction_list[sig];
 	if ( action.flags & SA_ONESHOT )
@@ -312,6 +553,7 @@ void user_sigreturn(void)
 	
 	local_ctx->user_rip = context->rip;            /* jump into jit code, */
 	context->rip = (long)state_restore;            /* not user code       */
+	import_guest_xmm(context->fpstate);
 	load_sigframe(&frame);
 }
 
@@ -325,6 +567,7 @@ void user_rt_sigreturn(void)
 	struct sigcontext *context = &frame.uc.uc_mcontext;
 	local_ctx->user_rip = context->rip;            /* jump into jit code, */
 	context->rip = (long)state_restore;            /* not user code       */
+	import_guest_xmm(context->fpstate);
 	frame.uc.uc_stack = (stack_t)
 	{
 		.ss_sp = local_ctx->sigwrap_stack,
@@ -346,7 +589,7 @@ void altstack_setup(void)
 		.ss_size = sizeof( local_ctx->sigwrap_stack )
 	};
 
-	if ( (ret=sys_sigaltstack(&sigwrap_altstack, &local_ctx->altstack)) )
+	if ( (ret=sys_sigaltstack(&sigwrap_altstack, &writable_ctx()->altstack)) )
 		die("altstack_setup: sigaltstack failed: %d", ret);
 }
 
@@ -384,11 +627,9 @@ void sigwrap_init(void)
 long user_sigaltstack(const stack_t *ss, stack_t *oss)
 {
 	long ret;
-	unprotect_ctx();
 	altstack_restore();
 	ret = sys_sigaltstack(ss, oss);
 	altstack_setup();
-	protect_ctx();
 	return ret;
 }
 
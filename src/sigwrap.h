@@ -24,9 +24,15 @@
 
 #include "kernel_compat.h"
 
+extern int lazy_signals;
+
 int try_block_signals(void);
 int block_signals(void);
 void unblock_signals(void);
+int try_defer_signals(void);
+void defer_signals(void);
+void undefer_signals(void);
+void deliver_delayed_signal(void);
 void altstack_setup(void);
 void sigwrap_init(void);
 void load_sigframe(struct kernel_sigframe *frame);
@@ -32,12 +32,38 @@
 #include "taint.h"
 #include "debug.h"
 #include "taint_dump.h"
+#include "taint_summary.h"
 #include "threads.h"
+#include "vdso.h"
 
-long syscall_emu(long call, long arg1, long arg2, long arg3,
-                            long arg4, long arg5, long arg6)
+/* calls which leave the emulator through another door (exec, a new thread,
+ * sigreturn) need the real signal mask in old_sigset, the rest only defers
+ */
+static int needs_sigmask(long call)
+{
+	switch (call)
+	{
+#ifndef __x86_64__
+		case __NR_sigreturn:
+#endif
+		case __NR_rt_sigreturn:
+		case __NR_fork:
+		case __NR_vfork:
+		case __NR_clone:
+		case __NR_exit:
+		case __NR_execve:
+		case __NR_exit_group:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* what syscall_emu() does with a call, also used by the translator to send
+ * calls which are only passed on to syscall_direct(), see generate_syscall_direct()
+ */
+int syscall_class(long call)
 {
-	long ret;
 	switch (call)
 	{
  		case __NR_brk:
@@ -45,6 +71,7 @@ long syscall_emu(long call, long arg1, long arg2, long arg3,
  		case __NR_mmap2:
 #endif
  		case __NR_mmap:
+ 		case __NR_munmap:
  		case __NR_mremap:
  		case __NR_mprotect:
  		case __NR_madvise:
@@ -65,38 +92,149 @@ long syscall_emu(long call, long arg1, long arg2, long arg3,
 
 		case __NR_execve:
 		case __NR_exit_group:
-			break;
+#ifndef __x86_64__
+ 		case __NR_ipc: /* only SHMAT */
+#endif
+			return SYSCALL_EMU;
 
 		case __NR_read:
 		case __NR_readv:
+		case __NR_pread64:
+		case __NR_preadv:
+#ifdef __NR_preadv2
+		case __NR_preadv2:
+#endif
+		case __NR_recvfrom:
+		case __NR_recvmsg:
+		case __NR_recvmmsg:
+		case __NR_vmsplice:
+		case __NR_process_vm_readv:
 		case __NR_open:
 		case __NR_creat:
 		case __NR_dup:
 		case __NR_dup2:
+		case __NR_dup3:
+		case __NR_fcntl:
+#ifndef __x86_64__
+		case __NR_fcntl64:
+#endif
+		case __NR_close:
+#ifdef __NR_close_range
+		case __NR_close_range:
+#endif
 		case __NR_openat:
 		case __NR_pipe:
+		case __NR_pipe2:
+#ifdef __NR_socket
+		case __NR_socket:
+		case __NR_socketpair:
+		case __NR_accept:
+		case __NR_accept4:
+#endif
 #ifndef __x86_64__
 		case __NR_socketcall:
 #endif
+			return SYSCALL_TAINT;
+
+		case __NR_clock_gettime:
+		case __NR_gettimeofday:
+		case __NR_time:
+			return SYSCALL_TIME;
+
+		default:
+			return SYSCALL_PASS;
+	}
+}
+
+/* work done before every call, returns 0 if the call should only be marked
+ * for a restart, because a delayed signal came in while finishing an instruction
+ */
+static int syscall_prepare(void)
+{
+	if (get_thread_ctx()->sig_pending)
+	{
+		deliver_delayed_signal();
+
+		if (get_thread_ctx()->jit_fragment_running)
+			return 0;
+	}
+
+	if (taint_reclaim_interval)
+		taint_reclaim_tick();
+
+	return 1;
+}
+
+/* entered through linux_syscall_direct, for calls of class SYSCALL_PASS with
+ * a number that was known at translation time
+ */
+long syscall_direct(long call, long arg1, long arg2, long arg3,
+                               long arg4, long arg5, long arg6)
+{
+	syscall_prepare();
+
+	/* does not run the call if we are finishing an instruction */
+	return syscall_intr(call,arg1,arg2,arg3,arg4,arg5,arg6);
+}
+
+long syscall_emu(long call, long arg1, long arg2, long arg3,
+                            long arg4, long arg5, long arg6)
+{
+	long ret;
+	int masked;
+
+	if ( !syscall_prepare() )
+		/* does not run the call, marks it for a restart */
+		return syscall_intr(call,arg1,arg2,arg3,arg4,arg5,arg6);
+
+	switch (syscall_class(call))
+	{
+		case SYSCALL_TAINT:
+		{
+			taint_args_t saved;
+
+			/* -dualtaint: taint may go live during the call (ours or another
+			 * thread's), after which the bare code we came from must not run
+			 * anymore, return through user_eip to the instrumented code
+			 */
+			if ( taint_flag == TAINT_CLEAN )
+				get_thread_ctx()->jit_rip = 0;
+
+			if ( taint_flag != TAINT_OFF )
+				save_taint_args(&saved,call,arg1,arg2,arg3,arg4,arg5,arg6);
+
 			ret = syscall_intr(call,arg1,arg2,arg3,arg4,arg5,arg6);
 
-			if ( taint_flag == TAINT_ON )
-				do_taint(ret,call,arg1,arg2,arg3,arg4,arg5,arg6);
+			if ( taint_flag != TAINT_OFF )
+				do_taint(ret,call,arg1,arg2,arg3,arg4,arg5,arg6,&saved);
 
 			return ret;
+		}
 
-#ifndef __x86_64__
- 		case __NR_ipc:
-			if ( arg1 == SHMAT )
-				break;
-			/* fall through */
-#endif
-		default:
+		case SYSCALL_TIME:
+			if ( vdso_time(call, arg1, arg2, &ret) )
+				return ret;
+
+			return syscall_intr(call,arg1,arg2,arg3,arg4,arg5,arg6);
+
+		case SYSCALL_PASS:
 			return syscall_intr(call,arg1,arg2,arg3,arg4,arg5,arg6);
+
+		default:
+			break;
 	}
 
+#ifndef __x86_64__
+	if ( (call == __NR_ipc) && (arg1 != SHMAT) )
+		return syscall_intr(call,arg1,arg2,arg3,arg4,arg5,arg6);
+#endif
+
+	/* may move the guest elsewhere, return through user_eip */
+	get_thread_ctx()->jit_rip = 0;
+
 	ret = call;
-	if (!try_block_signals())
+	masked = needs_sigmask(call);
+	if ( masked ? !try_block_signals() : !try_defer_signals() )
 		return ret; /* we have a signal in progress, revert to pre-syscall state */
 
 	switch (call)
@@ -119,6 +257,9 @@ long syscall_emu(long call, long arg1, long arg2, long arg3,
 			ret = user_mmap(arg1,arg2,arg3,arg4,arg5,arg6);
 			break;
 #endif
+ 		case __NR_munmap:
+			ret = user_munmap(arg1,arg2);
+			break;
  		case __NR_mremap:
 			ret = user_mremap(arg1,arg2,arg3,arg4,arg5);
 			break;
@@ -192,7 +333,11 @@ long syscall_emu(long call, long arg1, long arg2, long arg3,
 			die("unimplemented syscall");
 			break;
 	}
-	unblock_signals();
+	if (masked)
+		unblock_signals();
+	else
+		undefer_signals();
+
 	return ret;
 }
 
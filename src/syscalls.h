@@ -31,8 +31,20 @@ long syscall4(long no, long a0, long a1, long a2, long a3);
 long syscall5(long no, long a0, long a1, long a2, long a3, long a4);
 long syscall6(long no, long a0, long a1, long a2, long a3, long a4, long a5);
 
+enum
+{
+	SYSCALL_PASS,  /* only passed on to the kernel */
+	SYSCALL_TAINT, /* passed on, and may introduce taint */
+	SYSCALL_TIME,  /* served from the vDSO when possible */
+	SYSCALL_EMU,   /* emulated */
+};
+
+int syscall_class(long call);
+
 long syscall_emu(long call, long arg1, long arg2, long arg3,
                             long arg4, long arg5, long arg6);
+long syscall_direct(long call, long arg1, long arg2, long arg3,
+                               long arg4, long arg5, long arg6);
 
 /* does not go through if a signal arrived before the call */
 long syscall_intr(long call, long arg1, long arg2, long arg3,
@@ -55,6 +67,12 @@ long syscall_intr(long call, long arg1, long arg2, long arg3,
 #define sys_madvise(a, b, c) \
 	syscall3(SYS_madvise, (long)(a), (long)(b), (long)(c))
 
+#define sys_mincore(a, b, c) \
+	syscall3(SYS_mincore, (long)(a), (long)(b), (long)(c))
+
+#define sys_clock_gettime(a, b) \
+	syscall2(SYS_clock_gettime, (long)(a), (long)(b))
+
 #define sys_mremap(a, b, c, d, e) \
 	syscall5(SYS_mremap, (long)(a), (long)(b), (long)(c), (long)(d), (long)e)
 
@@ -71,6 +89,9 @@ long syscall_intr(long call, long arg1, long arg2, long arg3,
 #define sys_read(a, b, c) \
 	syscall3(SYS_read, (long)(a), (long)(b), (long)(c))
 
+#define sys_pread64(a, b, c, d) \
+	syscall4(SYS_pread64, (long)(a), (long)(b), (long)(c), (long)(d))
+
 #define sys_write(a, b, c) \
 	syscall3(SYS_write, (long)(a), (long)(b), (long)(c))
 
@@ -89,6 +110,15 @@ long syscall_intr(long call, long arg1, long arg2, long arg3,
 #define sys_close(a) \
 	syscall1(SYS_close, (long)(a))
 
+#define sys_fcntl(a, b, c) \
+	syscall3(SYS_fcntl, (long)(a), (long)(b), (long)(c))
+
+#define sys_ftruncate(a, b) \
+	syscall2(SYS_ftruncate, (long)(a), (long)(b))
+
+#define sys_memfd_create(a, b) \
+	syscall2(SYS_memfd_create, (long)(a), (long)(b))
+
 #define sys_exit(a) \
 	syscall1(SYS_exit, (long)(a))
 
@@ -98,6 +128,12 @@ long syscall_intr(long call, long arg1, long arg2, long arg3,
 #define sys_tgkill(a, b, c) \
 	syscall3(SYS_tgkill, (long)(a), (long)(b), (long)(c))
 
+#define sys_getpid() \
+	syscall0(SYS_getpid)
+
+#define sys_rt_tgsigqueueinfo(a, b, c, d) \
+	syscall4(SYS_rt_tgsigqueueinfo, (long)(a), (long)(b), (long)(c), (long)(d))
+
 #define sys_set_thread_area(a) \
 	syscall1(SYS_set_thread_area, (long)(a))
 
@@ -148,6 +184,9 @@ long syscall_intr(long call, long arg1, long arg2, long arg3,
 #define sys_clone(a, b, c, d, e) \
 	syscall5(SYS_clone, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e))
 
+#define sys_futex(a, b, c, d, e, f) \
+	syscall6(SYS_futex, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e), (long)(f))
+
 #define sys_prctl(a, b, c, d, e) \
 	syscall5(SYS_prctl, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e))
 
@@ -22,6 +22,7 @@
 #include <linux/limits.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <fcntl.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -34,8 +35,16 @@
 #include "threads.h"
 #include "proc.h"
 #include "error.h"
+#include "jit.h"
+#include "codemap.h"
+#include "taint_summary.h"
 
+#ifndef TAINT_BITMAP
 int taint_flag = TAINT_ON;
+#else
+int taint_flag = TAINT_OFF;
+#endif
+int taint_dual = 0;
 
 char *trusted_dirs_default = "/bin:/sbin:/lib:/lib32:"
                              "/usr/bin:/usr/sbin:/usr/lib:/usr/lib32:"
@@ -92,12 +101,12 @@ if (match) sys_gettid();
 	return match;
 }
 
-static int is_trusted_file(int fd)
+static int is_trusted_path(int fd)
 {
 	if (!trusted_dirs)
 		return 1;
 
-	char path[PATH_MAX+1], proc_file[64], *dirs;
+	char path[PATH_MAX+1], proc_file[64];
 
 	strcpy(proc_file, "/proc/self/fd/");
 	numcat(proc_file, fd);
@@ -111,37 +120,130 @@ static int is_trusted_file(int fd)
 	return in_dirlist(path, trusted_dirs);
 }
 
+/* Trust decisions are cached per (dev, inode), for the whole process, so
+ * that opening the same file again does not cost another readlink().
+ * The ctime is part of the key: moving or linking a file elsewhere updates
+ * it, and it keeps a recycled inode number from matching a stale entry.
+ */
+#define TRUST_CACHE_SIZE (4096)
+
+typedef struct
+{
+	unsigned long long dev, ino;
+	unsigned long ctime, ctime_nsec;
+	long trusted; /* 0: empty, 1: untrusted, 2: trusted */
+
+} trust_entry_t;
+
+static trust_entry_t trust_cache[TRUST_CACHE_SIZE];
+static long trust_lock = 0;
+
+static trust_entry_t *trust_entry(struct kernel_stat64 *s)
+{
+	unsigned long h = (unsigned long)(s->st_ino ^ (s->st_dev<<7) ^ (s->st_ino>>12));
+	return &trust_cache[(h*2654435761UL) % TRUST_CACHE_SIZE];
+}
+
+static int is_trusted_file(int fd)
+{
+	if (!trusted_dirs)
+		return 1;
+
+	struct kernel_stat64 s;
+	if ( sys_fstat(fd, &s) < 0 )
+		return is_trusted_path(fd);
+
+	trust_entry_t *e = trust_entry(&s);
+	long trusted = 0;
+
+	mutex_lock(&trust_lock);
+	if ( (e->ino == s.st_ino) && (e->dev == s.st_dev) &&
+	     (e->ctime == s.st_ctime) && (e->ctime_nsec == s.st_ctime_nsec) )
+		trusted = e->trusted;
+	mutex_unlock(&trust_lock);
+
+	if (trusted)
+		return trusted-1;
+
+	trusted = is_trusted_path(fd)+1;
+
+	mutex_lock(&trust_lock);
+	*e = (trust_entry_t){ .dev = s.st_dev, .ino = s.st_ino,
+	                      .ctime = s.st_ctime, .ctime_nsec = s.st_ctime_nsec,
+	                      .trusted = trusted };
+	mutex_unlock(&trust_lock);
+
+	return trusted-1;
+}
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
 #define __S_IFREG   0100000 /* Regular file.  */
 #define __S_IFMT    0170000 /* These bits determine file type.  */
 
-static int taint_val(int fd)
+static char *fd_type_slot(int fd)
+{
+	if ( (fd < 0) || (fd >= MAX_FDS) )
+		return NULL;
+
+	return &get_thread_ctx()->files->fd_type[fd];
+}
+
+static int get_fd(int fd)
+{
+	char *slot = fd_type_slot(fd);
+	return slot ? *slot : FD_UNKNOWN;
+}
+
+static void note_fd(int fd)
+{
+	file_ctx_t *files = get_thread_ctx()->files;
+	long high_fd;
+
+	while ( (high_fd = files->high_fd) <= fd )
+		if ( __sync_bool_compare_and_swap(&files->high_fd, high_fd, fd+1) )
+			break;
+}
+
+/* the entry only changes if no other thread has closed or reused the fd in
+ * the meantime, otherwise we go with whatever that thread stored
+ */
+static char update_fd(char *slot, char old, char new)
+{
+	__sync_bool_compare_and_swap(slot, old, new);
+	return *slot;
+}
+
+int taint_val(int fd)
 {
-	char *fd_type = get_thread_ctx()->files->fd_type;
+	char *slot = fd_type_slot(fd);
+	char type;
 
-	if ( (fd > 1023) || (fd < 0) )
+	if (slot == NULL)
 		return TAINT_CLEAR;
 
-	if ( fd_type[fd] == FD_UNKNOWN )
+	type = *slot;
+
+	if ( type == FD_UNKNOWN )
 	{
 		struct kernel_stat64 s;
+		note_fd(fd);
 		if ( ( sys_fstat(fd, &s) < 0 ) || (s.st_mode & __S_IFMT) != __S_IFREG )
-			fd_type[fd] = FD_SOCKET;
+			type = update_fd(slot, FD_UNKNOWN, FD_SOCKET);
 		else
-			fd_type[fd] = FD_FILE;
+			type = update_fd(slot, FD_UNKNOWN, FD_FILE);
 	}
 
-	if (fd_type[fd] == FD_FILE)
-	{
-		if (is_trusted_file(fd))
-			fd_type[fd] = FD_TRUSTED_FILE;
-		else
-			fd_type[fd] = FD_UNTRUSTED_FILE;
-	}
+	if (type == FD_FILE)
+		type = update_fd(slot, FD_FILE, is_trusted_file(fd) ? FD_TRUSTED_FILE :
+		                                                      FD_UNTRUSTED_FILE);
 
-	if (fd_type[fd] == FD_SOCKET)
+	if (type == FD_SOCKET)
 		return TAINT_SOCKET;
 
-	if (fd_type[fd] == FD_UNTRUSTED_FILE)
+	if (type == FD_UNTRUSTED_FILE)
 		return TAINT_FILE;
 
 	return TAINT_CLEAR;
@@ -149,18 +251,64 @@ static int taint_val(int fd)
 
 static void set_fd(int fd, int type)
 {
-	if ( (fd < 1024) && (fd > -1) )
-		get_thread_ctx()->files->fd_type[fd] = type;
+	char *slot = fd_type_slot(fd);
+
+	if (slot)
+	{
+		note_fd(fd);
+		*slot = type;
+	}
 }
 
+static void close_fds(unsigned long first, unsigned long last)
+{
+	unsigned long high_fd = get_thread_ctx()->files->high_fd;
+
+	for (; (first <= last) && (first < high_fd); first++)
+		set_fd(first, FD_UNKNOWN);
+}
+
+/* -dualtaint: as long as no taint has been introduced, the shadow memory and
+ * the register taint are all zero, and code is translated without taint
+ * instrumentation.  The first taint source switches to tainting for good:
+ * the bare code is retired so that everything gets translated again, and
+ * bare code that is still running leaves through the checks on its
+ * backward jumps.
+ */
+void taint_went_live(void)
+{
+	mutex_lock(&jit_lock);
+
+	if (taint_flag == TAINT_CLEAN)
+	{
+		taint_flag = TAINT_ON;
+		retire_jit_code();
+		set_taint_live();
+	}
+
+	mutex_unlock(&jit_lock);
+}
+
+#ifndef TAINT_BITMAP
+
 void taint_mem(void *mem, unsigned long size, int type)
 {
+	if (type != TAINT_CLEAR)
+		taint_summary_mark(mem, size);
+
 	memset((char *)mem+TAINT_OFFSET, type, size);
+
+	if (type == TAINT_CLEAR)
+		taint_summary_clear(mem, size);
 }
 
 void taint_or(void *mem, unsigned long size, int type)
 {
 	unsigned long i;
+
+	if (type != TAINT_CLEAR)
+		taint_summary_mark(mem, size);
+
 	for (i=0; i<size; i++)
 		*((char *)mem+i+TAINT_OFFSET) |= type;
 }
@@ -172,6 +320,101 @@ void taint_and(void *mem, unsigned long size, int type)
 		*((char *)mem+i+TAINT_OFFSET) &= type;
 }
 
+int get_mem_taint(void *mem)
+{
+	return *((unsigned char *)mem+TAINT_OFFSET);
+}
+
+void get_taint_bytes(unsigned char *dest, void *mem, unsigned long size)
+{
+	memcpy(dest, (char *)mem+TAINT_OFFSET, size);
+}
+
+#else
+
+/* -DTAINT_BITMAP: one bit per guest byte at the start of the shadow region,
+ * whatever the colour.  Only the C side knows about it so far, see TODO.
+ */
+#define BITMAP_BYTE(p) ((unsigned char *)TAINT_START + ((unsigned long)(p)-USER_START)/8)
+#define BITMAP_BIT(p)  (1U << (((unsigned long)(p)-USER_START)%8))
+#define BYTE_ALIGNED(p) ((((unsigned long)(p)-USER_START)%8) == 0)
+
+/* what a set bit reads back as */
+#define BITMAP_TAINT (TAINT_SOCKET)
+
+/* the bytes at either end may be shared with memory another thread taints */
+static void set_taint_bits(char *mem, unsigned long size, int set)
+{
+	char *end = mem+size;
+	unsigned long n;
+
+	for (; (mem < end) && !BYTE_ALIGNED(mem); mem++)
+		if (set)
+			__sync_fetch_and_or(BITMAP_BYTE(mem), BITMAP_BIT(mem));
+		else
+			__sync_fetch_and_and(BITMAP_BYTE(mem), ~BITMAP_BIT(mem));
+
+	n = (end-mem)/8;
+	memset(BITMAP_BYTE(mem), set ? 0xff : 0, n);
+	mem += n*8;
+
+	for (; mem < end; mem++)
+		if (set)
+			__sync_fetch_and_or(BITMAP_BYTE(mem), BITMAP_BIT(mem));
+		else
+			__sync_fetch_and_and(BITMAP_BYTE(mem), ~BITMAP_BIT(mem));
+}
+
+void taint_mem(void *mem, unsigned long size, int type)
+{
+	if (type != TAINT_CLEAR)
+		taint_summary_mark(mem, size);
+
+	set_taint_bits(mem, size, type != TAINT_CLEAR);
+
+	if (type == TAINT_CLEAR)
+		taint_summary_clear(mem, size);
+}
+
+void taint_or(void *mem, unsigned long size, int type)
+{
+	if (type == TAINT_CLEAR)
+		return;
+
+	taint_summary_mark(mem, size);
+	set_taint_bits(mem, size, 1);
+}
+
+/* which colours a bit stands for is not known, only and-ing away all of
+ * them clears it
+ */
+void taint_and(void *mem, unsigned long size, int type)
+{
+	if (type == TAINT_CLEAR)
+		set_taint_bits(mem, size, 0);
+}
+
+/* whole pages only, like mremap() */
+void taint_move(void *dest, void *src, unsigned long size)
+{
+	memmove(BITMAP_BYTE(dest), BITMAP_BYTE(src), size/8);
+}
+
+int get_mem_taint(void *mem)
+{
+	return (*BITMAP_BYTE(mem) & BITMAP_BIT(mem)) ? BITMAP_TAINT : TAINT_CLEAR;
+}
+
+void get_taint_bytes(unsigned char *dest, void *mem, unsigned long size)
+{
+	unsigned long i;
+
+	for (i=0; i<size; i++)
+		dest[i] = get_mem_taint((char *)mem+i);
+}
+
+#endif
+
 unsigned long get_reg_taint(int reg)
 {
 	if ( (reg > 7) || (reg < 0) )
@@ -208,7 +451,7 @@ void set_reg_taint(int reg, unsigned long val)
 static void taint_iov(struct iovec *iov, int iocnt, unsigned long size, int type)
 {
 	unsigned long v_size;
-	while (size > 0)
+	while ( (size > 0) && (iocnt-- > 0) )
 	{
 		v_size = iov->iov_len;
 		if (v_size > size)
@@ -219,7 +462,120 @@ static void taint_iov(struct iovec *iov, int iocnt, unsigned long size, int type
 	}
 }
 
-void do_taint(long ret, long call, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6)
+static unsigned long min(unsigned long a, unsigned long b) { return a<b ? a:b; }
+
+/* a bad pointer makes the call fail, so reading it is only a problem
+ * if we do not know the memory, only bound by the largest address then
+ */
+static unsigned int saved_len(void *len)
+{
+	if ( len && user_readable((unsigned long)len, sizeof(socklen_t)) )
+		return *(socklen_t *)len;
+
+	return sizeof(struct sockaddr_storage);
+}
+
+/* maxlen is the size of the buffer before the call */
+static void taint_sockaddr(void *addr, socklen_t *addrlen, unsigned int maxlen)
+{
+	if (addr && addrlen)
+		taint_mem(addr, min(*addrlen, maxlen), TAINT_SOCKADDR);
+}
+
+static void taint_msg(struct msghdr *msg, unsigned long size, unsigned int namelen)
+{
+	taint_sockaddr(msg->msg_name, &msg->msg_namelen, namelen);
+	taint_iov( msg->msg_iov, msg->msg_iovlen, size, TAINT_SOCKET );
+}
+
+/* recvmmsg(), glibc only defines struct mmsghdr with _GNU_SOURCE */
+struct kernel_mmsghdr
+{
+	struct msghdr msg_hdr;
+	unsigned int msg_len;
+};
+
+/* ret is the number of messages, every message has its own length */
+static void taint_mmsg(struct kernel_mmsghdr *msgvec, long n_msg, taint_args_t *a)
+{
+	long i;
+	for (i=0; (i<n_msg) && (i<MAX_MMSG); i++)
+		taint_msg(&msgvec[i].msg_hdr, msgvec[i].msg_len, a->addrlen[i]);
+}
+
+static void save_mmsg(taint_args_t *a, struct kernel_mmsghdr *msgvec, unsigned long n_msg)
+{
+	unsigned long i;
+	for (i=0; (i<n_msg) && (i<MAX_MMSG); i++)
+		a->addrlen[i] = saved_len(msgvec ? &msgvec[i].msg_hdr.msg_namelen : NULL);
+}
+
+/* called before the call, do_taint() clamps to the saved lengths */
+void save_taint_args(taint_args_t *a, long call, long arg1, long arg2, long arg3,
+                                                 long arg4, long arg5, long arg6)
+{
+	switch (call)
+	{
+		case __NR_recvfrom:
+			a->addrlen[0] = saved_len((void *)arg6);
+			return;
+		case __NR_recvmsg:
+			a->addrlen[0] = saved_len(&((struct msghdr *)arg2)->msg_namelen);
+			return;
+		case __NR_recvmmsg:
+			save_mmsg(a, (struct kernel_mmsghdr *)arg2, arg3);
+			return;
+#ifdef __NR_socket
+		case __NR_accept:
+		case __NR_accept4:
+			a->addrlen[0] = saved_len((void *)arg3);
+			return;
+#endif
+#ifndef __x86_64__
+		case __NR_socketcall:
+		{
+			long *sockargs = (long *)arg2;
+
+			if ( !user_readable(arg2, 6*sizeof(long)) )
+				sockargs = NULL;
+
+			switch (arg1)
+			{
+				case SYS_GETPEERNAME:
+				case SYS_ACCEPT:
+				case SYS_ACCEPT4:
+					a->addrlen[0] = saved_len(sockargs ? (void *)sockargs[2] : NULL);
+					return;
+				case SYS_RECVFROM:
+					a->addrlen[0] = saved_len(sockargs ? (void *)sockargs[5] : NULL);
+					return;
+				case SYS_RECVMSG:
+					a->addrlen[0] = saved_len(sockargs ? &((struct msghdr *)sockargs[1])->msg_namelen : NULL);
+					return;
+				case SYS_RECVMMSG:
+					if (sockargs)
+						save_mmsg(a, (struct kernel_mmsghdr *)sockargs[1], sockargs[2]);
+					else
+						save_mmsg(a, NULL, MAX_MMSG);
+					return;
+				default:
+					return;
+			}
+		}
+#endif
+		default:
+			return;
+	}
+}
+
+/* vmsplice() on the read end of a pipe copies into the iovecs */
+static int is_read_end(int fd)
+{
+	return (sys_fcntl(fd, F_GETFL, 0) & O_ACCMODE) == O_RDONLY;
+}
+
+void do_taint(long ret, long call, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6,
+              taint_args_t *a)
 {
 	if (ret < 0)
 		return;
@@ -230,8 +586,38 @@ void do_taint(long ret, long call, long arg1, long arg2, long arg3, long arg4, l
 			taint_mem((char *)arg2, ret, taint_val(arg1));
 			return;
 		case __NR_readv:
+		case __NR_preadv:
+#ifdef __NR_preadv2
+		case __NR_preadv2:
+#endif
 			taint_iov( (struct iovec *)arg2, arg3, ret, taint_val(arg1));
 			return;
+		case __NR_pread64:
+			taint_mem((char *)arg2, ret, taint_val(arg1));
+			return;
+		case __NR_recvfrom:
+			/* with MSG_TRUNC, ret is the size of the datagram */
+			taint_mem((char *)arg2, min(ret, arg3), TAINT_SOCKET);
+			taint_sockaddr((void *)arg5, (socklen_t *)arg6, a->addrlen[0]);
+			return;
+		case __NR_recvmsg:
+			taint_msg((struct msghdr *)arg2, ret, a->addrlen[0]);
+			return;
+		case __NR_recvmmsg:
+			taint_mmsg((struct kernel_mmsghdr *)arg2, ret, a);
+			return;
+		case __NR_vmsplice:
+			if ( is_read_end(arg1) )
+				taint_iov( (struct iovec *)arg2, arg3, ret, TAINT_SOCKET);
+			return;
+		case __NR_process_vm_readv:
+			/* another process' memory, as untrusted as a socket */
+			taint_iov( (struct iovec *)arg2, arg3, ret, TAINT_SOCKET);
+			return;
+		/* splice(), tee() and sendfile() move data between file descriptors
+		 * without passing through our memory, the taint is applied when the
+		 * data is read from the destination
+		 */
 		case __NR_open:
 		case __NR_creat:
 		case __NR_openat:
@@ -245,12 +631,45 @@ void do_taint(long ret, long call, long arg1, long arg2, long arg3, long arg4, l
 			return;
 		case __NR_dup:
 		case __NR_dup2:
-			set_fd( ret, get_thread_ctx()->files->fd_type[arg1]);
+			set_fd( ret, get_fd(arg1) );
+			return;
+		case __NR_dup3:
+			set_fd( ret, get_fd(arg1) );
 			return;
+#ifndef __x86_64__
+		case __NR_fcntl64:
+#endif
+		case __NR_fcntl:
+			if ( (arg2 == F_DUPFD) || (arg2 == F_DUPFD_CLOEXEC) )
+				set_fd( ret, get_fd(arg1) );
+			return;
+		case __NR_close:
+			close_fds(arg1, arg1);
+			return;
+#ifdef __NR_close_range
+		case __NR_close_range:
+			if ( !(arg3 & CLOSE_RANGE_CLOEXEC) )
+				close_fds(arg1, arg2);
+			return;
+#endif
 		case __NR_pipe:
-			set_fd( ((long *)arg1)[0], FD_SOCKET);
-			set_fd( ((long *)arg1)[1], FD_SOCKET);
+		case __NR_pipe2:
+			set_fd( ((int *)arg1)[0], FD_SOCKET);
+			set_fd( ((int *)arg1)[1], FD_SOCKET);
 			return;
+#ifdef __NR_socket
+		case __NR_accept:
+		case __NR_accept4:
+			taint_sockaddr((void *)arg2, (socklen_t *)arg3, a->addrlen[0]);
+			/* fall through */
+		case __NR_socket:
+			set_fd(ret, FD_SOCKET);
+			return;
+		case __NR_socketpair:
+			set_fd( ((int *)arg4)[0], FD_SOCKET);
+			set_fd( ((int *)arg4)[1], FD_SOCKET);
+			return;
+#endif
 #ifndef __x86_64__
 		case __NR_socketcall:
 		{
@@ -259,25 +678,32 @@ void do_taint(long ret, long call, long arg1, long arg2, long arg3, long arg4, l
 			switch (arg1)
 			{
 				case SYS_GETPEERNAME:
-					if ( (ret >= 0) && sockargs[1] && sockargs[2])
-						taint_mem((char *)sockargs[1], *(long *)sockargs[2], TAINT_SOCKADDR);
+					taint_sockaddr((void *)sockargs[1], (socklen_t *)sockargs[2], a->addrlen[0]);
 					return;
 				case SYS_ACCEPT:
-					if ( (ret >= 0) && sockargs[1] && sockargs[2])
-						taint_mem((char *)sockargs[1], *(long *)sockargs[2], TAINT_SOCKADDR);
+				case SYS_ACCEPT4:
+					taint_sockaddr((void *)sockargs[1], (socklen_t *)sockargs[2], a->addrlen[0]);
+					/* fall through */
 				case SYS_SOCKET:
 					set_fd(ret, FD_SOCKET);
 					return;
+				case SYS_SOCKETPAIR:
+					set_fd( ((int *)sockargs[3])[0], FD_SOCKET);
+					set_fd( ((int *)sockargs[3])[1], FD_SOCKET);
+					return;
 				case SYS_RECV:
+					taint_mem((char *)sockargs[1], min(ret, sockargs[2]), TAINT_SOCKET);
+					return;
 				case SYS_RECVFROM:
-					taint_mem((char *)sockargs[1], ret, TAINT_SOCKET);
+					taint_mem((char *)sockargs[1], min(ret, sockargs[2]), TAINT_SOCKET);
+					taint_sockaddr((void *)sockargs[4], (socklen_t *)sockargs[5], a->addrlen[0]);
 					return;
 				case SYS_RECVMSG:
-				{
-					struct msghdr *msg = (struct msghdr *)sockargs[1];
-					taint_iov( msg->msg_iov, msg->msg_iovlen, ret, TAINT_SOCKET );
+					taint_msg((struct msghdr *)sockargs[1], ret, a->addrlen[0]);
+					return;
+				case SYS_RECVMMSG:
+					taint_mmsg((struct kernel_mmsghdr *)sockargs[1], ret, a);
 					return;
-				}
 				default:
 					return;
 			}
@@ -29,6 +29,7 @@ enum
 {
 	TAINT_ON,
 	TAINT_OFF,
+	TAINT_CLEAN, /* -dualtaint, no taint seen yet: translate as TAINT_OFF */
 };
 
 enum
@@ -63,15 +64,38 @@ enum
 #define TAINT_LONG(a) (0x01010101*(a))
 
 extern int taint_flag;
+extern int taint_dual;
 
 extern char *trusted_dirs_default;
 extern char *trusted_dirs;
 int set_trusted_dirs(char *dirs);
 
+void taint_went_live(void);
+int taint_val(int fd);
 void taint_mem(void *mem, unsigned long size, int type);
 void taint_or(void *mem, unsigned long size, int type);
 void taint_and(void *mem, unsigned long size, int type);
-void do_taint(long ret, long call, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6);
+#ifdef TAINT_BITMAP
+void taint_move(void *dest, void *src, unsigned long size);
+#endif
+int get_mem_taint(void *mem);
+void get_taint_bytes(unsigned char *dest, void *mem, unsigned long size);
+
+#define MAX_MMSG (1024) /* UIO_MAXIOV, the kernel's limit for recvmmsg() */
+
+/* the sizes of the address buffers the caller passed in, the kernel
+ * replaces them with the size of the address it had, even if it did not fit
+ */
+typedef struct
+{
+	unsigned int addrlen[MAX_MMSG];
+
+} taint_args_t;
+
+void save_taint_args(taint_args_t *a, long call, long arg1, long arg2, long arg3,
+                                                 long arg4, long arg5, long arg6);
+void do_taint(long ret, long call, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6,
+              taint_args_t *a);
 
 void get_xmm5(unsigned char *xmm5);
 void get_xmm6(unsigned char *xmm6);
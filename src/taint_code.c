@@ -38,6 +38,30 @@
  *          taint_index(reg)
  */
 
+/* When the cpu has AVX, sequences which copy %xmm6 into the scratch register
+ * only to shuffle it in place use the VEX three-operand forms instead, which
+ * write %xmm5 directly.  Only VEX.128 encodings are used, these clear the
+ * upper ymm halves, so mixing them with the legacy SSE code costs nothing.
+ * The register layout stays the same.
+ */
+int taint_vex = 0;
+
+void taint_code_init(void)
+{
+	unsigned int eax=1, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+
+	__asm__ __volatile__ ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+	/* AVX, and the OS saves the ymm state (OSXSAVE, XCR0 SSE|AVX) */
+	if ( (ecx & (1<<28|1<<27)) != (1<<28|1<<27) )
+		return;
+
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+
+	if ( (xcr0_lo & 0x6) == 0x6 )
+		taint_vex = 1;
+}
+
 /*
  * INSERTP taint_index(reg), taint_reg(reg)|scratch_reg(), mem32
  * PEXTRD  taint_index(reg), taint_reg(reg)|scratch_reg(), mem32
@@ -105,8 +129,8 @@ int offset_mem(char *dst_mrm, char *src_mrm, long offset)
 	}
 
 	dst_mrm[0] = mrm;
-	imm_to(&dst_mrm[imm_index], disp32);
-	return imm_index+sizeof(long);
+	memcpy(&dst_mrm[imm_index], &disp32, 4);
+	return imm_index+4;
 }
 
 static const char *pslldq_5         = "\x66\x0f\x73\xfd\x00",
@@ -128,6 +152,11 @@ static const char *pslldq_5         = "\x66\x0f\x73\xfd\x00",
                   *pxorpunpckhbw_6_to_5 = "\x66\x0f\xef\xed\x66\x0f\x68\xee",
                   *por_6_to_5       = "\x66\x0f\xeb\xee";
 
+static const char *vpslldq_6_to_5       = "\xc5\xd1\x73\xfe\x00",
+                  *vpunpcklbw_66_to_5   = "\xc5\xc9\x60\xee",
+                  *vpunpckhbw_66_to_5   = "\xc5\xc9\x68\xee",
+                  *vpinsrb_6_to_5       = "\xc4\xe3\x49\x20";
+
 /* in the same column as REG */
 static int scratch_load_mem32(char *dest, char *mrm, long offset)
 {
@@ -291,6 +320,32 @@ int taint_copy_push_reg32(char *dest, int reg, long offset)
 	return 11;
 }
 
+/* push %r1 ; push %r2 ; ... before the first push: two stack slots per
+ * 16 byte shadow store, the upper halves of the slots are cleared
+ */
+int taint_copy_push_regs(char *dest, int *regs, int n, long offset)
+{
+	int i, len = 0;
+
+	for (i=0; i+1<n; i+=2)
+	{
+		memcpy(&dest[len], insertps, 4);            /* insertps $?, %xmm?, %xmm5 */
+		dest[len+4] = 0xC0 | ( scratch_reg()<<3 ) | taint_reg(regs[i]);
+		dest[len+5] = (taint_index(regs[i])<<6) | (2<<4) | 0xb;
+		memcpy(&dest[len+6], insertps, 4);
+		dest[len+10] = 0xC0 | ( scratch_reg()<<3 ) | taint_reg(regs[i+1]);
+		dest[len+11] = (taint_index(regs[i+1])<<6) | (0<<4);
+		memcpy(&dest[len+12], "\xf3\x0f\x7f\xac\x24", 5); /* movdqu %xmm5, addr */
+		imm_to(&dest[len+17], offset-(i+2)*sizeof(long));
+		len += 21;
+	}
+
+	if (i < n)
+		len += taint_copy_push_reg32(&dest[len], regs[i], offset-i*sizeof(long));
+
+	return len;
+}
+
 int taint_copy_push_mem32(char *dest, char *mrm, long offset)
 {
 	if ( !is_memop(mrm) )
@@ -309,6 +364,30 @@ int taint_copy_pop_reg32(char *dest, int reg, long offset)
 	return 11;
 }
 
+/* pop %r1 ; pop %r2 ; ... before the first pop, two stack slots per load */
+int taint_copy_pop_regs(char *dest, int *regs, int n, long offset)
+{
+	int i, len = 0;
+
+	for (i=0; i+1<n; i+=2)
+	{
+		memcpy(&dest[len], "\xf3\x0f\x6f\xac\x24", 5);    /* movdqu addr, %xmm5 */
+		imm_to(&dest[len+5], offset+i*sizeof(long));
+		memcpy(&dest[len+9], insertps, 4);           /* insertps $?, %xmm5, %xmm? */
+		dest[len+13] = 0xC0 | ( taint_reg(regs[i])<<3 ) | scratch_reg();
+		dest[len+14] = (0<<6) | (taint_index(regs[i])<<4);
+		memcpy(&dest[len+15], insertps, 4);
+		dest[len+19] = 0xC0 | ( taint_reg(regs[i+1])<<3 ) | scratch_reg();
+		dest[len+20] = (2<<6) | (taint_index(regs[i+1])<<4);
+		len += 21;
+	}
+
+	if (i < n)
+		len += taint_copy_pop_reg32(&dest[len], regs[i], offset+i*sizeof(long));
+
+	return len;
+}
+
 int taint_copy_pop_mem32(char *dest, char *mrm, long offset)
 {
 	if ( !is_memop(mrm) )
@@ -1006,6 +1085,10 @@ int taint_swap_reg16_mem16(char *dest, char *mrm, long offset)
 
 /* autogenerated table indicating which opcodes/immediates to use for byte copies
  *
+ * gen/tablegen_copybyte.py scores pre_shift 0 best, then negative (palignr),
+ * then positive (movapd+pslldq).  With VEX the positive shift no longer
+ * needs the movapd and a zero shift merges into the unpack, which leaves
+ * the order of the solutions the same, so the table is shared.
  */
 static const struct { char pre_shift, post_shift, upper_half; } bytecopy_table[8][8] =
 {
@@ -1041,6 +1124,13 @@ int shift_xmm6_to_xmm5(char *dest, int c)
 		dest[5] = -c;
 		return 6;
 	}
+	else if ( taint_vex && (c > 0) )
+	{
+		/* vpslldq, no movapd needed */
+		memcpy(dest, vpslldq_6_to_5, 5);
+		dest[4] = c;
+		return 5;
+	}
 	else
 	{
 		memcpy(dest, movapd_6_to_5, 4);
@@ -1053,10 +1143,21 @@ int taint_copy_reg8_to_reg8(char *dest, int from_reg, int to_reg)
 	if ( from_reg == to_reg )
 		return 0;
 
-	int len = shift_xmm6_to_xmm5(dest, bytecopy_table[from_reg][to_reg].pre_shift);
-	memcpy(&dest[len], bytecopy_table[from_reg][to_reg].upper_half ? punpckhbw_6_to_5 :
-	                                                                 punpcklbw_6_to_5, 4);
-	len += 4;
+	int len, upper = bytecopy_table[from_reg][to_reg].upper_half;
+
+	if ( taint_vex && (bytecopy_table[from_reg][to_reg].pre_shift == 0) )
+	{
+		/* vpunpck[lh]bw %xmm6, %xmm6, %xmm5 */
+		memcpy(dest, upper ? vpunpckhbw_66_to_5 : vpunpcklbw_66_to_5, 4);
+		len = 4;
+	}
+	else
+	{
+		len = shift_xmm6_to_xmm5(dest, bytecopy_table[from_reg][to_reg].pre_shift);
+		memcpy(&dest[len], upper ? punpckhbw_6_to_5 : punpcklbw_6_to_5, 4);
+		len += 4;
+	}
+
 	len += shift_xmm5(&dest[len], bytecopy_table[from_reg][to_reg].post_shift);
 	memcpy(&dest[len], blendw_5_to_6, 6);
 	len += 6;
@@ -1162,6 +1263,20 @@ static int scratch_load_mem8(char *dest, char *mrm, long offset)
 	return len;
 }
  
+/* %xmm5 = %xmm6 with one byte replaced by the shadow of the memory operand */
+static int scratch_copy_load_mem8(char *dest, char *mrm, long offset)
+{
+	if (taint_vex)
+	{
+		int len = scratch_load_mem8(dest, mrm, offset);
+		memcpy(dest, vpinsrb_6_to_5, 4);
+		return len;
+	}
+
+	memcpy(dest, movapd_6_to_5, 4);
+	return 4+scratch_load_mem8(&dest[4], mrm, offset);
+}
+
 int taint_or_reg8_to_mem8(char *dest, char *mrm, long offset)
 {
 	if ( !is_memop(mrm) )
@@ -1451,8 +1566,7 @@ int taint_cmpxchg8_pre(char *dest, char *mrm, long offset)
 	if ( !is_memop(mrm) )
 		return 0;
 
-	memcpy(dest, movapd_6_to_5, 4);
-	int len = 4+scratch_load_mem8(&dest[4], mrm, offset);
+	int len = scratch_copy_load_mem8(dest, mrm, offset);
 	dest[len-1] = reg8_index[0]; /* patch to load into %al column */
 	return len;
 }
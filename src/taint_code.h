@@ -22,6 +22,10 @@
 
 /* all tainting is done pre-op */
 
+extern int taint_vex;
+
+void taint_code_init(void);
+
 int offset_mem(char *dst_mrm, char *src_mrm, long offset);
 
 int taint_ijmp(char *dest, int p2, char *mrm, long offset);
@@ -43,12 +47,14 @@ int taint_copy_reg8_to_mem8(char *dest, char *mrm, long offset);
 
 int taint_copy_push_reg32(char *dest, int reg, long offset);
 int taint_copy_push_reg16(char *dest, int reg, long offset);
+int taint_copy_push_regs(char *dest, int *regs, int n, long offset);
 
 int taint_copy_push_mem32(char *dest, char *mrm, long offset);
 int taint_copy_push_mem16(char *dest, char *mrm, long offset);
 
 int taint_copy_pop_reg32(char *dest, int reg, long offset);
 int taint_copy_pop_reg16(char *dest, int reg, long offset);
+int taint_copy_pop_regs(char *dest, int *regs, int n, long offset);
 
 int taint_copy_pop_mem32(char *dest, char *mrm, long offset);
 int taint_copy_pop_mem16(char *dest, char *mrm, long offset);
@@ -32,6 +32,7 @@
 #include "hexdump.h"
 #include "threads.h"
 #include "taint.h"
+#include "taint_summary.h"
 #include "proc.h"
 
 int dump_on_exit = 0;
@@ -59,21 +60,24 @@ void hexdump_taint(int fd, const void *data, ssize_t len,
 
 void dump_map(int fd, char *addr, unsigned long len)
 {
-	long *laddr;
-	unsigned long i,j, last=0xFFFFFFFF;
+	unsigned long i, j, last=0xFFFFFFFF;
+	unsigned char taint[256];
 	int t;
 
 	i=0;
 
+	if (!dump_all && !taint_summary_sweep(addr, len))
+		return;
+
 	/* trim the stack a bit */
 	if ( dump_all && (long)addr == (long)(USER_END-USER_STACK_SIZE) )
 	{
 		for (; i<len; i++)
-			if ( addr[i] || addr[i+TAINT_OFFSET] )
+			if ( addr[i] || get_mem_taint(&addr[i]) )
 				break;
 
 		for (; len>0; len--)
-			if ( addr[len-1] || addr[len-1+TAINT_OFFSET] )
+			if ( addr[len-1] || get_mem_taint(&addr[len-1]) )
 				break;
 
 		i = PAGE_BASE(i);
@@ -82,15 +86,7 @@ void dump_map(int fd, char *addr, unsigned long len)
 
 	for (; i<len; i+=PG_SIZE)
 	{
-		t = dump_all;
-
-		if (!t)
-		{
-			laddr = (long *)&addr[i+TAINT_OFFSET];
-			for (j=0; j<PG_SIZE/sizeof(long); j++)
-				if (laddr[j])
-					t=1;
-		}
+		t = dump_all || taint_page_dirty(&addr[i]);
 
 		if (t)
 		{
@@ -99,8 +95,11 @@ void dump_map(int fd, char *addr, unsigned long len)
 			else if (i != last+PG_SIZE)
 				fd_printf(fd, "...\n");
 
-			hexdump_taint(fd, &addr[i], PG_SIZE,
-			              (unsigned char *)&addr[i+TAINT_OFFSET], 1, 1, NULL);
+			for (j=0; j<PG_SIZE; j+=sizeof(taint))
+			{
+				get_taint_bytes(taint, &addr[i+j], sizeof(taint));
+				hexdump_taint(fd, &addr[i+j], sizeof(taint), taint, 1, 1, NULL);
+			}
 			last = i;
 		}
 	}
@@ -167,6 +166,9 @@ void do_taint_dump(long *regs)
 
 	do_regs_dump(fd, regs);
 
+	hugepage_report(fd);
+	taint_reclaim_report(fd);
+
 	map_file_t f;
 	map_entry_t e;
 	open_maps(&f);
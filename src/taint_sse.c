@@ -0,0 +1,677 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ * Copyright 2011 Vrije Universiteit Amsterdam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <stddef.h>
+
+#include "taint_sse.h"
+#include "taint_code.h"
+#include "jit_code.h"
+#include "threads.h"
+#include "mm.h"
+
+/* Every guest xmm register has 16 bytes of taint in thread_ctx_t.xmm_taint,
+ * indexed by the guest's register number, %xmm5 is the scratch register.
+ * The taint code runs before generate_sse() remaps %xmm3-%xmm7.
+ *
+ * Instructions which only move bytes around (mov*, punpck*, pshuf*, shufp*,
+ * palignr, ps[rl]ldq, pinsr*, pextr*, pmov[sz]x, blends with an immediate)
+ * are run a second time, on %xmm5 and the taint of the other operand:
+ * shadow memory or %fs:xmm_taint[rm].  The pack instructions are run with
+ * signed saturation, which keeps non-zero taint non-zero.  Everything else
+ * ORs the taint of its operands together.
+ *
+ * Not tracked: mmx registers (masked in cpuid), maskmovdqu, the implicit
+ * %xmm0 of the blendv family and the results of pcmp[ei]str[im].  Shifts
+ * by a register count leave the taint where it is.
+ */
+
+#define SCRATCH (5)
+
+#define XT(n)       ((long)offsetof(thread_ctx_t, xmm_taint[n]))
+#define XMM_FOLD(n) ((long)offsetof(thread_ctx_t, xmm_fold[n]))
+#define GUEST_XMM(n) ((long)offsetof(thread_ctx_t, guest_xmm[(n)-3]))
+#define TAINT_TMP   ((long)offsetof(thread_ctx_t, taint_tmp))
+
+enum
+{
+	XT_NONE,
+	XT_SAME,      /* moves bytes around, run it on the taint as well */
+	XT_OR,        /* dest |= src */
+	XT_CLEAR,     /* dest |= src, constant result if reg == rm */
+	XT_SHIFT,     /* shift by an immediate */
+	XT_SHUFB,     /* pshufb */
+	XT_TO_GPR,    /* result goes to a general purpose register */
+	XT_FROM_GPR,  /* general purpose register operand */
+};
+
+enum { AT_CTX, AT_MEM, AT_REG };
+
+typedef struct
+{
+	instr_t *instr;
+	int map, op, pfx;
+	int reg, rm, mem;
+	int width;    /* of the memory operand, for XT_OR */
+	char opcode[3];
+	int opcode_len;
+
+} sse_t;
+
+static const char *movdqa_load  = "\x66\x0f\x6f",
+                  *movdqa_store = "\x66\x0f\x7f",
+                  *movd_load    = "\x66\x0f\x6e",
+                  *movq_load    = "\xf3\x0f\x7e",
+                  *movlps_load  = "\x0f\x12",
+                  *movhps_load  = "\x0f\x16",
+                  *por          = "\x66\x0f\xeb",
+                  *pinsrd       = "\x66\x0f\x3a\x22",
+                  *pextrd       = "\x66\x0f\x3a\x16",
+                  *pextrw       = "\x66\x0f\x3a\x15",
+                  *insertps     = "\x66\x0f\x3a\x21",
+                  *pxor_5       = "\x66\x0f\xef\xed",
+                  *pshufd_5     = "\x66\x0f\x70\xed",
+                  *movl_0       = "\x64\xc7\x04\x25",      /* movl $0, %fs:off */
+                  *movq_0       = "\x64\x48\xc7\x04\x25";  /* movq $0, %fs:off */
+
+static int gpr_taint_reg(int reg)
+{
+	return 0x06 | reg>>2;
+}
+
+static int gpr_taint_index(int reg)
+{
+	return reg & 0x03;
+}
+
+static int disp32(char *dest, long off)
+{
+	int d = off;
+	memcpy(dest, &d, 4);
+	return 4;
+}
+
+static int rip_relative(sse_t *s)
+{
+	return s->mem && ( (s->instr->addr[s->instr->mrm] & 0xC7) == 0x05 );
+}
+
+static long rip_target(sse_t *s)
+{
+	instr_t *instr = s->instr;
+	return (long)&instr->addr[instr->len] + imm_at(&instr->addr[instr->mrm+1], 4);
+}
+
+/* the guest's memory operand + offset, %rip relative operands made absolute */
+static int sse_mem(char *dest, sse_t *s, long offset)
+{
+	if ( rip_relative(s) )
+	{
+		dest[0] = 0x04;
+		dest[1] = 0x25;
+		return 2+disp32(&dest[2], rip_target(s)+offset);
+	}
+
+	return offset_mem(dest, &s->instr->addr[s->instr->mrm], offset);
+}
+
+/* op <operand>, %xmmN  (or the other way around, depending on op)
+ *
+ * AT_CTX: %fs:arg
+ * AT_MEM: the guest's memory operand + arg
+ * AT_REG: %xmm<arg>
+ */
+static int emit_op(char *dest, sse_t *s, const char *op, int op_len,
+                   int rex_w, int xmm, int at, long arg)
+{
+	instr_t *instr = s->instr;
+	int len = 0, mrm, rex = rex_w ? REX_W : 0;
+
+	if (at == AT_CTX)
+		dest[len++] = '\x64';
+	else if (at == AT_MEM)
+	{
+		if (instr->p[4])
+			dest[len++] = instr->p[4];
+		if ( !rip_relative(s) )
+			rex |= instr->p[5] & (REX_X|REX_B);
+	}
+	else if (arg & 8)
+		rex |= REX_B;
+
+	if (op[0] != '\x0f') /* mandatory prefix goes before rex */
+	{
+		dest[len++] = op[0];
+		op++;
+		op_len--;
+	}
+	if (rex)
+		dest[len++] = 0x40 | rex;
+
+	memcpy(&dest[len], op, op_len);
+	len += op_len;
+	mrm = len;
+
+	if (at == AT_CTX)
+	{
+		dest[len++] = 0x04;
+		dest[len++] = 0x25;
+		len += disp32(&dest[len], arg);
+	}
+	else if (at == AT_MEM)
+		len += sse_mem(&dest[len], s, arg);
+	else
+		dest[len++] = 0xC0 | (arg & 7);
+
+	dest[mrm] = ( dest[mrm] & ~0x38 ) | (xmm<<3);
+	return len;
+}
+
+/* the guest's instruction, with %xmm5 as its modrm.reg operand */
+static int guest_op(char *dest, sse_t *s, int at, long arg)
+{
+	instr_t *instr = s->instr;
+	char op[4];
+	int op_len = 0, len, imm_len = instr->len-instr->imm;
+
+	if (s->pfx)
+		op[op_len++] = s->pfx;
+	memcpy(&op[op_len], s->opcode, s->opcode_len);
+	op_len += s->opcode_len;
+
+	len = emit_op(dest, s, op, op_len, instr->p[5] & REX_W, SCRATCH, at, arg);
+	memcpy(&dest[len], &instr->addr[instr->imm], imm_len);
+	return len+imm_len;
+}
+
+static int load_xt(char *dest, sse_t *s, int n)
+{
+	return emit_op(dest, s, movdqa_load, 3, 0, SCRATCH, AT_CTX, XT(n));
+}
+
+static int store_xt(char *dest, sse_t *s, int n)
+{
+	return emit_op(dest, s, movdqa_store, 3, 0, SCRATCH, AT_CTX, XT(n));
+}
+
+static int ctx_imm32(char *dest, const char *op, int op_len, long off)
+{
+	memcpy(dest, op, op_len);
+	disp32(&dest[op_len], off);
+	disp32(&dest[op_len+4], 0);
+	return op_len+8;
+}
+
+/* xmm_taint[to] = op %fs:from_off, xmm_taint[to] */
+static int xt_merge(char *dest, sse_t *s, int to, const char *op, int op_len, long from_off, int imm)
+{
+	int len = load_xt(dest, s, to);
+	len += emit_op(&dest[len], s, op, op_len, 0, SCRATCH, AT_CTX, from_off);
+	if (imm >= 0)
+		dest[len++] = imm;
+	return len+store_xt(&dest[len], s, to);
+}
+
+static int xt_copy(char *dest, sse_t *s, int to, int from)
+{
+	int len = load_xt(dest, s, from);
+	return len+store_xt(&dest[len], s, to);
+}
+
+static int is_store(sse_t *s)
+{
+	if (s->map == G3A_OPTABLE)
+		return (s->op >= 0x14) && (s->op <= 0x17);
+
+	switch (s->op)
+	{
+		case 0x11: case 0x13: case 0x17: case 0x29: case 0x2B:
+		case 0x7F: case 0xD6: case 0xE7:
+			return 1;
+		case 0x7E:
+			return s->pfx == 0x66;
+		default:
+			return 0;
+	}
+}
+
+static int sse_class(sse_t *s)
+{
+	int op = s->op, pfx = s->pfx;
+
+	if (s->map == G38_OPTABLE)
+	{
+		if ( (pfx != 0x66) || (op >= 0xF0) )
+			return XT_NONE; /* mmx, movbe, crc32 */
+
+		if (op == 0x00)
+			return XT_SHUFB;
+
+		if ( ( (op >= 0x20) && (op <= 0x25) ) || ( (op >= 0x30) && (op <= 0x35) ) || (op == 0x2A) )
+			return XT_SAME;
+
+		if (op == 0x2B) /* packusdw -> packssdw */
+		{
+			memcpy(s->opcode, "\x0f\x6b", 2);
+			s->opcode_len = 2;
+			return XT_SAME;
+		}
+
+		if (op == 0x17)
+			return XT_NONE; /* ptest */
+
+		if ( (op == 0x29) || (op == 0x37) )
+			return XT_CLEAR;
+
+		return XT_OR;
+	}
+
+	if (s->map == G3A_OPTABLE)
+	{
+		if (pfx != 0x66)
+			return XT_NONE; /* mmx palignr */
+
+		if ( ( (op >= 0x0C) && (op <= 0x0F) ) || (op == 0x21) )
+			return XT_SAME;
+
+		if ( (op >= 0x14) && (op <= 0x17) )
+			return s->mem ? XT_SAME : XT_TO_GPR;
+
+		if ( (op == 0x20) || (op == 0x22) )
+			return s->mem ? XT_SAME : XT_FROM_GPR;
+
+		if ( (op >= 0x60) && (op <= 0x63) )
+			return XT_NONE; /* pcmp[ei]str[im] */
+
+		if (op == 0x0A)
+			s->width = 4; /* roundss */
+		if (op == 0x0B)
+			s->width = 8; /* roundsd */
+
+		return XT_OR;
+	}
+
+	/* ESC_OPTABLE */
+
+	if ( (pfx == 0) && (op >= 0x60) && (op != 0xC2) && (op != 0xC6) )
+		return XT_NONE; /* mmx */
+
+	if ( (op == 0xD6) && (pfx != 0x66) )
+		return XT_NONE; /* movq2dq, movdq2q */
+
+	/* scalar arithmetic */
+	if ( ( ( (op >= 0x51) && (op <= 0x5F) && (op != 0x5B) ) || (op == 0xC2) ) &&
+	     ( (pfx == 0xf3) || (pfx == 0xf2) ) )
+		s->width = (pfx == 0xf3) ? 4 : 8;
+
+	if ( ( (op == 0x5A) && (pfx == 0) ) || ( (op == 0xE6) && (pfx == 0xf3) ) )
+		s->width = 8; /* cvtps2pd, cvtdq2pd */
+
+	switch (op)
+	{
+		case 0x2E: case 0x2F: case 0xF7:
+			return XT_NONE; /* flags only, maskmovdqu */
+
+		case 0x2A:
+			if ( (pfx != 0xf3) && (pfx != 0xf2) )
+			{
+				s->width = 8;
+				return s->mem ? XT_OR : XT_NONE; /* from mmx */
+			}
+			s->width = (s->instr->p[5] & REX_W) ? 8 : 4;
+			return s->mem ? XT_OR : XT_FROM_GPR;
+
+		case 0x2C: case 0x2D:
+			if ( (pfx != 0xf3) && (pfx != 0xf2) )
+				return XT_NONE; /* to mmx */
+			return XT_TO_GPR;
+
+		case 0x50: case 0xC5: case 0xD7:
+			return XT_TO_GPR;
+
+		case 0x6E: case 0xC4:
+			return s->mem ? XT_SAME : XT_FROM_GPR;
+
+		case 0x7E:
+			return ( (pfx == 0x66) && !s->mem ) ? XT_TO_GPR : XT_SAME;
+
+		case 0x67: /* packuswb -> packsswb */
+			s->opcode[1] = '\x63';
+			return XT_SAME;
+
+		case 0x71: case 0x72: case 0x73:
+			return XT_SHIFT;
+
+		case 0x55: case 0x57: case 0x5C: case 0x64: case 0x65: case 0x66:
+		case 0x74: case 0x75: case 0x76: case 0xD8: case 0xD9: case 0xDF:
+		case 0xE8: case 0xE9: case 0xEF: case 0xF8: case 0xF9: case 0xFA: case 0xFB:
+			return XT_CLEAR;
+	}
+
+	if ( ( (op >= 0x10) && (op <= 0x17) ) || (op == 0x28) || (op == 0x29) || (op == 0x2B) ||
+	     ( (op >= 0x60) && (op <= 0x70) ) || (op == 0x7F) || (op == 0xC6) ||
+	     (op == 0xD6) || (op == 0xE7) || (op == 0xF0) )
+		return XT_SAME;
+
+	return XT_OR;
+}
+
+static int taint_same(char *dest, sse_t *s)
+{
+	int len = 0, imm;
+
+	if (s->mem)
+	{
+		len += load_xt(&dest[len], s, s->reg);
+		len += guest_op(&dest[len], s, AT_MEM, TAINT_OFFSET);
+		if ( !is_store(s) )
+			len += store_xt(&dest[len], s, s->reg);
+		return len;
+	}
+
+	/* register forms which do not behave like their memory forms */
+	if ( (s->map == G3A_OPTABLE) && (s->op == 0x21) ) /* insertps, picks a source lane */
+	{
+		imm = (unsigned char)s->instr->addr[s->instr->imm];
+		return xt_merge(dest, s, s->reg, insertps, 4, XT(s->rm) + 4*(imm>>6), imm & 0x3f);
+	}
+
+	if (s->map == ESC_OPTABLE) switch (s->op)
+	{
+		case 0x10:
+			if (s->pfx == 0xf3) /* movss */
+				return xt_merge(dest, s, s->reg, insertps, 4, XT(s->rm), 0);
+			if (s->pfx == 0xf2) /* movsd */
+				return xt_merge(dest, s, s->reg, movlps_load, 2, XT(s->rm), -1);
+			/* fall through */
+		case 0x28: case 0x6F:
+			return xt_copy(dest, s, s->reg, s->rm);
+		case 0x11:
+			if (s->pfx == 0xf3)
+				return xt_merge(dest, s, s->rm, insertps, 4, XT(s->reg), 0);
+			if (s->pfx == 0xf2)
+				return xt_merge(dest, s, s->rm, movlps_load, 2, XT(s->reg), -1);
+			/* fall through */
+		case 0x29: case 0x7F:
+			return xt_copy(dest, s, s->rm, s->reg);
+		case 0x12:
+			if (s->pfx == 0) /* movhlps */
+				return xt_merge(dest, s, s->reg, movlps_load, 2, XT(s->rm)+8, -1);
+			break;
+		case 0x16:
+			if (s->pfx == 0) /* movlhps */
+				return xt_merge(dest, s, s->reg, movhps_load, 2, XT(s->rm), -1);
+			break;
+		case 0xD6: /* movq, zero extends */
+			len += emit_op(&dest[len], s, movq_load, 3, 0, SCRATCH, AT_CTX, XT(s->reg));
+			return len+store_xt(&dest[len], s, s->rm);
+	}
+
+	len += load_xt(&dest[len], s, s->reg);
+	len += guest_op(&dest[len], s, AT_CTX, XT(s->rm));
+	return len+store_xt(&dest[len], s, s->reg);
+}
+
+static int taint_or(char *dest, sse_t *s, int clear)
+{
+	int len = 0;
+
+	if ( !s->mem && clear && (s->reg == s->rm) )
+	{
+		memcpy(dest, pxor_5, 4);
+		len = 4;
+	}
+	else if ( !s->mem )
+	{
+		len += load_xt(&dest[len], s, s->reg);
+		len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_CTX, XT(s->rm));
+	}
+	else if (s->width == 16)
+	{
+		len += load_xt(&dest[len], s, s->reg);
+		len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_MEM, TAINT_OFFSET);
+	}
+	else
+	{
+		len += emit_op(&dest[len], s, s->width == 4 ? movd_load : movq_load, 3,
+		               0, SCRATCH, AT_MEM, TAINT_OFFSET);
+		len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_CTX, XT(s->reg));
+	}
+
+	return len+store_xt(&dest[len], s, s->reg);
+}
+
+static int shift_5(char *dest, int op, int digit, int imm)
+{
+	memcpy(dest, "\x66\x0f", 2);
+	dest[2] = op;
+	dest[3] = 0xC0 | (digit<<3) | SCRATCH;
+	dest[4] = imm;
+	return 5;
+}
+
+/* Byte shifts move the taint exactly.  Bit shifts move it by whole bytes,
+ * rounded both ways and ORed together.  Arithmetic shifts keep the old
+ * taint as well, for the sign bits.
+ */
+static int taint_shift(char *dest, sse_t *s)
+{
+	int digit = (s->instr->addr[s->instr->mrm]>>3) & 7,
+	    imm = (unsigned char)s->instr->addr[s->instr->imm],
+	    arith = (digit == 4), logical = (digit == 6) ? 6 : 2,
+	    len = load_xt(dest, s, s->rm);
+
+	if ( (s->op == 0x73) && ( (digit == 3) || (digit == 7) ) ) /* ps[rl]ldq */
+		len += shift_5(&dest[len], s->op, digit, imm);
+	else
+	{
+		if (arith)
+			len += emit_op(&dest[len], s, movdqa_store, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(1));
+
+		if (imm & ~7)
+			len += shift_5(&dest[len], s->op, logical, imm & ~7);
+
+		if (imm & 7)
+		{
+			len += emit_op(&dest[len], s, movdqa_store, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(0));
+			len += shift_5(&dest[len], s->op, logical, 8);
+			len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(0));
+		}
+
+		if (arith)
+			len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(1));
+	}
+
+	return len+store_xt(&dest[len], s, s->rm);
+}
+
+/* the control operand shuffles its own value's taint, and taints everything */
+static int taint_shufb(char *dest, sse_t *s)
+{
+	int len = load_xt(dest, s, s->reg);
+
+	if (s->mem)
+	{
+		len += guest_op(&dest[len], s, AT_MEM, 0);
+		len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_MEM, TAINT_OFFSET);
+	}
+	else
+	{
+		if ( (s->rm >= 3) && (s->rm <= 7) )
+			len += guest_op(&dest[len], s, AT_CTX, GUEST_XMM(s->rm));
+		else
+			len += guest_op(&dest[len], s, AT_REG, s->rm);
+
+		len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_CTX, XT(s->rm));
+	}
+
+	return len+store_xt(&dest[len], s, s->reg);
+}
+
+static int taint_to_gpr(char *dest, sse_t *s)
+{
+	int to_rm = (s->map == G3A_OPTABLE) || (s->op == 0x7E),
+	    gpr = to_rm ? s->rm : s->reg,
+	    src = to_rm ? s->reg : s->rm,
+	    len = 0;
+
+	if (gpr >= 8)
+		return 0; /* no taint for %r8-%r15 */
+
+	if ( (s->map == G3A_OPTABLE) || (s->op == 0xC5) )
+	{
+		/* pextr*, zero extended into the register */
+		len += ctx_imm32(&dest[len], movl_0, 4, TAINT_TMP);
+		len += load_xt(&dest[len], s, src);
+		if (s->op == 0xC5)
+		{
+			len += emit_op(&dest[len], s, pextrw, 4, 0, SCRATCH, AT_CTX, TAINT_TMP);
+			dest[len++] = s->instr->addr[s->instr->imm];
+		}
+		else
+			len += guest_op(&dest[len], s, AT_CTX, TAINT_TMP);
+
+		len += emit_op(&dest[len], s, pinsrd, 4, 0, gpr_taint_reg(gpr), AT_CTX, TAINT_TMP);
+		dest[len++] = gpr_taint_index(gpr);
+		return len;
+	}
+
+	if (s->op == 0x7E) /* movd / movq */
+	{
+		len += emit_op(&dest[len], s, pinsrd, 4, 0, gpr_taint_reg(gpr), AT_CTX, XT(src));
+		dest[len++] = gpr_taint_index(gpr);
+		return len;
+	}
+
+	/* movmsk*, cvt*2si, every source byte may end up anywhere */
+	if (s->mem)
+		len += emit_op(&dest[len], s, s->pfx == 0xf3 ? movd_load : movq_load, 3,
+		               0, SCRATCH, AT_MEM, TAINT_OFFSET);
+	else
+		len += load_xt(&dest[len], s, src);
+
+	len += emit_op(&dest[len], s, movdqa_store, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(0));
+	memcpy(&dest[len], pshufd_5, 4);
+	dest[len+4] = '\x4e';
+	len += 5;
+	len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(0));
+	len += emit_op(&dest[len], s, movdqa_store, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(0));
+	memcpy(&dest[len], pshufd_5, 4);
+	dest[len+4] = '\xb1';
+	len += 5;
+	len += emit_op(&dest[len], s, por, 3, 0, SCRATCH, AT_CTX, XMM_FOLD(0));
+
+	len += emit_op(&dest[len], s, insertps, 4, 0, gpr_taint_reg(gpr), AT_REG, SCRATCH);
+	dest[len++] = gpr_taint_index(gpr)<<4;
+	return len;
+}
+
+static int taint_from_gpr(char *dest, sse_t *s)
+{
+	int gpr = s->rm, len = 0;
+
+	if (s->op == 0x6E) /* movd / movq, zero extends */
+	{
+		memcpy(dest, pxor_5, 4);
+		len = 4;
+		if (gpr < 8)
+		{
+			len += emit_op(&dest[len], s, insertps, 4, 0, SCRATCH, AT_REG, gpr_taint_reg(gpr));
+			dest[len++] = gpr_taint_index(gpr)<<6;
+		}
+		return len+store_xt(&dest[len], s, s->reg);
+	}
+
+	if (s->op == 0x2A) /* cvtsi2s[sd], into the low element */
+	{
+		len += load_xt(&dest[len], s, s->reg);
+		if (gpr < 8)
+		{
+			len += emit_op(&dest[len], s, insertps, 4, 0, SCRATCH, AT_REG, gpr_taint_reg(gpr));
+			dest[len++] = gpr_taint_index(gpr)<<6;
+		}
+		else
+		{
+			len += emit_op(&dest[len], s, insertps, 4, 0, SCRATCH, AT_REG, SCRATCH);
+			dest[len++] = 0x01;
+		}
+		return len+store_xt(&dest[len], s, s->reg);
+	}
+
+	/* pinsr*, through taint_tmp so the instruction itself can be used */
+	len += ctx_imm32(&dest[len], movq_0, 5, TAINT_TMP);
+	if (gpr < 8)
+	{
+		len += emit_op(&dest[len], s, pextrd, 4, 0, gpr_taint_reg(gpr), AT_CTX, TAINT_TMP);
+		dest[len++] = gpr_taint_index(gpr);
+	}
+	len += load_xt(&dest[len], s, s->reg);
+	len += guest_op(&dest[len], s, AT_CTX, TAINT_TMP);
+	return len+store_xt(&dest[len], s, s->reg);
+}
+
+int taint_sse(char *dest, instr_t *instr)
+{
+	unsigned char mrm = instr->addr[instr->mrm];
+	long target;
+	sse_t s =
+	{
+		.instr = instr,
+		.map = instr->op & ~0xff,
+		.op = instr->op & 0xff,
+		.pfx = instr->p[3] == 0x66 ? 0x66 :
+		       instr->p[1] == 0xf3 ? 0xf3 :
+		       instr->p[1] == 0xf2 ? 0xf2 : 0,
+		.reg = ( (mrm>>3) & 7 ) | ( (instr->p[5] & REX_R) ? 8 : 0 ),
+		.rm  = (  mrm     & 7 ) | ( (instr->p[5] & REX_B) ? 8 : 0 ),
+		.mem = (mrm & 0xC0) != 0xC0,
+		.width = 16,
+		.opcode_len = (instr->op & ~0xff) == ESC_OPTABLE ? 2 : 3,
+	};
+
+	memcpy(s.opcode, &instr->addr[instr->mrm-s.opcode_len], s.opcode_len);
+
+	if ( rip_relative(&s) )
+	{
+		/* absolute addressing is sign extended */
+		target = rip_target(&s);
+		if ( (target < 0) || (target+TAINT_OFFSET+16 > 0x7fffffffL) )
+			return 0;
+	}
+
+	switch ( sse_class(&s) )
+	{
+		case XT_SAME:
+			return taint_same(dest, &s);
+		case XT_OR:
+			return taint_or(dest, &s, 0);
+		case XT_CLEAR:
+			return taint_or(dest, &s, 1);
+		case XT_SHIFT:
+			return taint_shift(dest, &s);
+		case XT_SHUFB:
+			return taint_shufb(dest, &s);
+		case XT_TO_GPR:
+			return taint_to_gpr(dest, &s);
+		case XT_FROM_GPR:
+			return taint_from_gpr(dest, &s);
+		default:
+			return 0;
+	}
+}
@@ -0,0 +1,453 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include "mm.h"
+#include "lib.h"
+#include "syscalls.h"
+#include "sigwrap.h"
+#include "threads.h"
+#include "proc.h"
+#include "taint.h"
+#include "taint_summary.h"
+
+/* Page taint summary
+ *
+ * One bit per guest page, set when the page's shadow memory may hold
+ * taint.  Taint sources (taint_mem(), taint_or(), hooks) mark pages as they
+ * go.
+ *
+ * Instrumented code stores taint without coming through here, and a check
+ * on every store would cost more than the summary saves.  The kernel marks
+ * those stores for us instead: a shadow page written since the last
+ * taint_reclaim() pass (or since it was mapped) has its soft-dirty bit set
+ * in /proc/self/pagemap.  Queries and sweeps fold those pages into the
+ * summary, so a clear bit means the page is clean.  Without soft-dirty
+ * tracking every shadow page which is present or swapped out counts as
+ * written.
+ *
+ * Sweeps rescan the shadow pages which are resident, and leave the others
+ * as the bitmap and pagemap have them.
+ *
+ * The translator consumes the summary only through taint_went_live(), the
+ * first mark retires the bare code.  Leaving out instrumentation for clean
+ * pages would need translations dropped on every later mark.
+ */
+
+#define BITS_PER_LONG (sizeof(long)*8)
+
+static unsigned long summary[USER_PAGES/BITS_PER_LONG];
+
+/* no taint source has run yet, so no shadow memory can hold taint */
+static int none_marked = 1;
+
+/* pages with a file_taint_shadow() (see mm.c), dropping those reverts them
+ * to TAINT_FILE instead of zero, so reclaim leaves them alone
+ */
+static unsigned long file_shadow[USER_PAGES/BITS_PER_LONG];
+
+static unsigned long page_index(void *addr)
+{
+	return ((unsigned long)addr-USER_START)/PG_SIZE;
+}
+
+static void set_bit_in(unsigned long *map, unsigned long i)
+{
+	unsigned long mask = 1UL<<(i%BITS_PER_LONG);
+
+	if (!(map[i/BITS_PER_LONG] & mask))
+		__sync_fetch_and_or(&map[i/BITS_PER_LONG], mask);
+}
+
+static void clear_bit_in(unsigned long *map, unsigned long i)
+{
+	unsigned long mask = 1UL<<(i%BITS_PER_LONG);
+
+	if (map[i/BITS_PER_LONG] & mask)
+		__sync_fetch_and_and(&map[i/BITS_PER_LONG], ~mask);
+}
+
+static int test_bit_in(unsigned long *map, unsigned long i)
+{
+	return (map[i/BITS_PER_LONG] >> (i%BITS_PER_LONG)) & 1;
+}
+
+static void set_bit(unsigned long i)   { set_bit_in(summary, i); }
+static void clear_bit(unsigned long i) { clear_bit_in(summary, i); }
+static int test_bit(unsigned long i)   { return test_bit_in(summary, i); }
+
+#define PM_SOFT_DIRTY (1ULL<<55)
+#define PM_SWAP       (1ULL<<62)
+#define PM_PRESENT    (1ULL<<63)
+#define PAGEMAP_BATCH (256)
+
+static long read_pagemap(long fd, void *addr, unsigned long n, unsigned long long *pm)
+{
+	long size = n*sizeof(*pm);
+	return sys_pread64(fd, pm, size, (unsigned long)addr/PG_SIZE*sizeof(*pm)) != size;
+}
+
+/* whether the kernel reports soft-dirty pages, a page we have just written
+ * must show up as one
+ */
+static int soft_dirty_supported(long fd)
+{
+	static int supported = -1;
+	static volatile long probe[PG_SIZE/sizeof(long)];
+	unsigned long long pm;
+
+	if (supported < 0)
+	{
+		probe[0] = 1;
+		if ( read_pagemap(fd, (void *)probe, 1, &pm) == 0 )
+			supported = !!(pm & PM_SOFT_DIRTY);
+	}
+
+	return supported > 0;
+}
+
+/* sets the bits of the pages in [addr, addr+len) whose shadow has been written
+ * since the last taint_summary_rearm(), returns the number of those pages
+ */
+static unsigned long mark_written(char *addr, unsigned long len)
+{
+	unsigned long long pm[PAGEMAP_BATCH], written;
+	char *page = (char *)PAGE_BASE(addr),
+	     *end = (char *)PAGE_NEXT(addr+len);
+	unsigned long n, i, marked = 0;
+	long fd;
+
+	if ( none_marked || (len == 0) || ((unsigned long)addr >= USER_END) )
+		return 0;
+
+	if ((unsigned long)end > USER_END)
+		end = (char *)USER_END;
+
+	fd = sys_open("/proc/self/pagemap", O_RDONLY, 0);
+	written = (fd >= 0) && soft_dirty_supported(fd) ? PM_SOFT_DIRTY : 0;
+
+	for (; page < end; page += n*PG_SIZE)
+	{
+		n = (end-page)/PG_SIZE;
+		if (n > PAGEMAP_BATCH)
+			n = PAGEMAP_BATCH;
+
+		if ( (fd < 0) || read_pagemap(fd, page+TAINT_OFFSET, n, pm) )
+			memset(pm, 0xff, n*sizeof(*pm));
+
+		for (i=0; i<n; i++)
+			if ( (pm[i] & (PM_SWAP|PM_PRESENT)) && ((pm[i] & written) == written) )
+			{
+				set_bit(page_index(&page[i*PG_SIZE]));
+				marked++;
+			}
+	}
+
+	if (fd >= 0)
+		sys_close(fd);
+
+	return marked;
+}
+
+/* from here on, mark_written() only sees shadow stores made after this call,
+ * every page which holds taint must have its bit set by now
+ */
+static void taint_summary_rearm(void)
+{
+	long fd = sys_open("/proc/self/clear_refs", O_WRONLY, 0);
+
+	if (fd < 0)
+		return;
+
+	sys_write(fd, "4", 1);
+	sys_close(fd);
+}
+
+/* pages overlapping [addr, addr+len) may hold taint now */
+void taint_summary_mark(void *addr, unsigned long len)
+{
+	unsigned long i, end;
+
+	if ( (len == 0) || ((unsigned long)addr >= USER_END) )
+		return;
+
+	none_marked = 0;
+
+	if (taint_flag == TAINT_CLEAN)
+		taint_went_live();
+
+	end = page_index((char *)addr+len-1);
+	if (end >= USER_PAGES)
+		end = USER_PAGES-1;
+
+	for (i=page_index(addr); i<=end; i++)
+		set_bit(i);
+}
+
+/* pages fully inside [addr, addr+len) have clean shadow memory */
+void taint_summary_clear(void *addr, unsigned long len)
+{
+	unsigned long i = page_index((char *)PAGE_NEXT((char *)addr)),
+	              end = page_index((char *)PAGE_BASE((char *)addr+len));
+
+	if (end > USER_PAGES)
+		end = USER_PAGES;
+
+	for (; i<end; i++)
+		clear_bit(i);
+}
+
+int taint_page_dirty(void *addr)
+{
+	if ((unsigned long)addr >= USER_END)
+		return 0;
+
+	return test_bit(page_index(addr));
+}
+
+int taint_summary_any(void *addr, unsigned long len)
+{
+	unsigned long i, end;
+
+	if ( (len == 0) || ((unsigned long)addr >= USER_END) )
+		return 0;
+
+	end = page_index((char *)addr+len-1);
+	if (end >= USER_PAGES)
+		end = USER_PAGES-1;
+
+	for (i=page_index(addr); i<=end; i++)
+		if (test_bit(i))
+			return 1;
+
+	return mark_written(addr, len) != 0;
+}
+
+/* pages overlapping [addr, addr+len) */
+void taint_summary_file_shadow(void *addr, unsigned long len, int file_backed)
+{
+	unsigned long i, end;
+
+	if ( (len == 0) || ((unsigned long)addr >= USER_END) )
+		return;
+
+	end = page_index((char *)addr+len-1);
+	if (end >= USER_PAGES)
+		end = USER_PAGES-1;
+
+	for (i=page_index(addr); i<=end; i++)
+		if (file_backed)
+			set_bit_in(file_shadow, i);
+		else
+			clear_bit_in(file_shadow, i);
+}
+
+int taint_summary_file_shadow_any(void *addr, unsigned long len)
+{
+	unsigned long i, end;
+
+	if ( (len == 0) || ((unsigned long)addr >= USER_END) )
+		return 0;
+
+	end = page_index((char *)addr+len-1);
+	if (end >= USER_PAGES)
+		end = USER_PAGES-1;
+
+	for (i=page_index(addr); i<=end; i++)
+		if (test_bit_in(file_shadow, i))
+			return 1;
+
+	return 0;
+}
+
+static int shadow_page_clean(char *page)
+{
+	long *l = (long *)(page+TAINT_OFFSET);
+	unsigned long i;
+
+	for (i=0; i<PG_SIZE/sizeof(long); i+=4)
+		if ( l[i] | l[i+1] | l[i+2] | l[i+3] )
+			return 0;
+
+	return 1;
+}
+
+#define SWEEP_BATCH (4096)
+
+/* Rescans the (readable) shadow memory of [addr, addr+len) and updates the
+ * summary to match, returns the number of pages which hold taint.
+ */
+unsigned long taint_summary_sweep(void *addr, unsigned long len)
+{
+	unsigned char vec[SWEEP_BATCH];
+	char *page = (char *)PAGE_BASE(addr),
+	     *end = (char *)PAGE_NEXT((char *)addr+len);
+	unsigned long n, i, dirty = 0;
+
+	if ((unsigned long)end > USER_END)
+		end = (char *)USER_END;
+
+	mark_written(addr, len);
+
+	for (; page < end; page += n*PG_SIZE)
+	{
+		n = (end-page)/PG_SIZE;
+		if (n > SWEEP_BATCH)
+			n = SWEEP_BATCH;
+
+		if ( sys_mincore(page+TAINT_OFFSET, n*PG_SIZE, vec) < 0 )
+			memset(vec, 1, n);
+
+		for (i=0; i<n; i++)
+		{
+			if ( !(vec[i] & 1) )
+				dirty += test_bit(page_index(&page[i*PG_SIZE]));
+			else if ( shadow_page_clean(&page[i*PG_SIZE]) )
+				clear_bit(page_index(&page[i*PG_SIZE]));
+			else
+			{
+				set_bit(page_index(&page[i*PG_SIZE]));
+				dirty++;
+			}
+		}
+	}
+
+	return dirty;
+}
+
+/* Shadow reclaim
+ *
+ * Shadow pages which have been written with zeroes (taint_mem(..., TAINT_CLEAR)
+ * on every read() from a trusted file for example) stay resident.  A reclaim
+ * pass gives the resident shadow pages which hold no taint back to the kernel.
+ *
+ * Another guest thread could store taint into a page between the check and
+ * the madvise(), or unmap the memory whose shadow we are reading, so this
+ * only happens while there is a single guest thread, which is the one doing
+ * the reclaim, with signals deferred.
+ */
+
+unsigned long taint_reclaim_interval = 0; /* seconds, 0: never */
+
+static unsigned long reclaimed_total = 0, reclaim_passes = 0;
+static long reclaim_lock = 0;
+
+static unsigned long reclaim_range(char *addr, unsigned long len)
+{
+	unsigned char vec[SWEEP_BATCH];
+	char *page = (char *)PAGE_BASE(addr),
+	     *end = (char *)PAGE_NEXT(addr+len),
+	     *run = NULL;
+	unsigned long n, i, reclaimed = 0;
+
+	if ((unsigned long)end > USER_END)
+		end = (char *)USER_END;
+
+	for (; page < end; page += n*PG_SIZE)
+	{
+		n = (end-page)/PG_SIZE;
+		if (n > SWEEP_BATCH)
+			n = SWEEP_BATCH;
+
+		if ( sys_mincore(page+TAINT_OFFSET, n*PG_SIZE, vec) < 0 )
+			memset(vec, 0, n);
+
+		for (i=0; i<=n; i++)
+		{
+			if ( (i < n) && (vec[i] & 1) && shadow_page_clean(&page[i*PG_SIZE]) &&
+			     !test_bit_in(file_shadow, page_index(&page[i*PG_SIZE])) )
+			{
+				if (run == NULL)
+					run = &page[i*PG_SIZE];
+			}
+			else if (run)
+			{
+				sys_madvise(run+TAINT_OFFSET, &page[i*PG_SIZE]-run, MADV_DONTNEED);
+				taint_summary_clear(run, &page[i*PG_SIZE]-run);
+				reclaimed += &page[i*PG_SIZE]-run;
+				run = NULL;
+			}
+		}
+	}
+
+	return reclaimed;
+}
+
+unsigned long taint_reclaim(void)
+{
+	map_file_t f;
+	map_entry_t e;
+	unsigned long reclaimed = 0;
+
+	if ( guest_thread_count() > 1 )
+		return 0;
+
+	mutex_lock(&reclaim_lock);
+
+	open_maps(&f);
+	while (read_map(&f, &e) && e.addr < USER_END)
+	{
+		mark_written((char *)e.addr, e.len);
+		if (e.prot & (PROT_READ|PROT_EXEC))
+			reclaimed += reclaim_range((char *)e.addr, e.len);
+	}
+	close_maps(&f);
+
+	taint_summary_rearm();
+
+	reclaimed_total += reclaimed;
+	reclaim_passes++;
+
+	mutex_unlock(&reclaim_lock);
+
+	return reclaimed;
+}
+
+/* called on every emulated syscall when -reclaim is given */
+void taint_reclaim_tick(void)
+{
+	static unsigned long calls = 0, last = 0;
+	struct timespec now;
+
+	if (++calls % 256)
+		return;
+
+	if ( (sys_clock_gettime(CLOCK_MONOTONIC, &now) != 0) ||
+	     ((unsigned long)now.tv_sec < last+taint_reclaim_interval) )
+		return;
+
+	last = now.tv_sec;
+
+	if (!try_defer_signals())
+		return;
+
+	taint_reclaim();
+	undefer_signals();
+}
+
+void taint_reclaim_report(int fd)
+{
+	if (reclaim_passes == 0)
+		return;
+
+	fd_printf(fd, "shadow memory: %u kB reclaimed in %u passes\n",
+	              reclaimed_total/1024, reclaim_passes);
+}
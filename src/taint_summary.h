@@ -0,0 +1,39 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TAINT_SUMMARY_H
+#define TAINT_SUMMARY_H
+
+void taint_summary_mark(void *addr, unsigned long len);
+void taint_summary_clear(void *addr, unsigned long len);
+
+int taint_page_dirty(void *addr);
+int taint_summary_any(void *addr, unsigned long len);
+
+void taint_summary_file_shadow(void *addr, unsigned long len, int file_backed);
+int taint_summary_file_shadow_any(void *addr, unsigned long len);
+
+unsigned long taint_summary_sweep(void *addr, unsigned long len);
+
+extern unsigned long taint_reclaim_interval;
+
+unsigned long taint_reclaim(void);
+void taint_reclaim_tick(void);
+void taint_reclaim_report(int fd);
+
+#endif /* TAINT_SUMMARY_H */
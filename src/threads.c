@@ -18,7 +18,10 @@
 
 #include <sys/mman.h>
 #include <linux/sched.h>
+#include <linux/memfd.h>
 #include <sched.h>
+#include <errno.h>
+#include <string.h>
 
 #include "threads.h"
 #include "syscalls.h"
@@ -27,14 +30,20 @@
 #include "mm.h"
 #include "jmp_cache.h"
 #include "sigwrap.h"
+#include "jit.h"
+#include "jit_spec.h"
 
 static thread_ctx_t __attribute__ ((aligned (0x1000))) ctx[MAX_THREADS];
+static char __attribute__ ((aligned (0x1000))) fragment_rw[MAX_THREADS][PG_SIZE];
 static sighandler_ctx_t sighandler;
-static file_ctx_t files;
+static file_ctx_t files[MAX_FILE_CTX];
 static long thread_lock;
 
+/* 0: free, 1: guest thread, HELPER_CTX: minemu internal thread */
 char ctx_map[MAX_THREADS];
 
+#define HELPER_CTX (2)
+
 static thread_ctx_t *alloc_ctx(void)
 {
 	int i;
@@ -63,28 +72,139 @@ static void unshare_ctx(thread_ctx_t *c)
 			ctx_map[i] = 0;
 }
 
-static void init_thread_ctx(thread_ctx_t *local_ctx)
+/* fd tables follow the kernel's: threads created with CLONE_FILES share
+ * their parent's, other children get a copy.  Returns NULL when we run out
+ * of tables, sharing is no option, the child could reuse an fd number for a
+ * file of another type than the parent's.  Called with thread_lock held.
+ */
+static file_ctx_t *clone_files(unsigned long flags, file_ctx_t *parent)
 {
-	long ret = sys_mmap(local_ctx, sizeof(thread_ctx_t),
-	                     PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS, -1, 0);
+	long high_fd = parent->high_fd;
+	int i;
 
-	if (ret != (long)local_ctx)
-		die("set_thread_ctx(): mmap() failed\n");
+	if (flags & CLONE_FILES)
+	{
+		parent->users++;
+		return parent;
+	}
+
+	for (i=0; i<MAX_FILE_CTX; i++)
+		if (files[i].users == 0)
+		{
+			memset(files[i].fd_type, 0, files[i].high_fd);
+			memcpy(files[i].fd_type, parent->fd_type, high_fd);
+			files[i].high_fd = high_fd;
+			files[i].users = 1;
+			return &files[i];
+		}
+
+	return NULL;
+}
+
+/* called with thread_lock held */
+static void put_files(file_ctx_t *f)
+{
+	f->users--;
+}
+
+/* after fork() the child's copy of the tables is its own */
+static void unshare_files(file_ctx_t *f)
+{
+	int i;
+	for (i=0; i<MAX_FILE_CTX; i++)
+		files[i].users = (&files[i] == f) ? 1 : 0;
+}
+
+/* Every jit_fragment page is a page of one memfd which is mapped twice:
+ * read/exec in the thread context itself, where the read-only words at the
+ * end of the page keep catching stack underruns, and read/write in
+ * fragment_rw[], so that we can write fragments without mprotect() calls.
+ */
+static void map_fragment_pages(void)
+{
+	long fd, ret;
+	int i;
 
-	local_ctx->my_addr = local_ctx;
+	fd = sys_memfd_create("jit_fragment", MFD_CLOEXEC);
+	if (fd < 0)
+		die("map_fragment_pages(): memfd_create() failed: %d", fd);
+
+	if ( (ret = sys_ftruncate(fd, sizeof(fragment_rw))) )
+		die("map_fragment_pages(): ftruncate() failed: %d", ret);
+
+	ret = sys_mmap(fragment_rw, sizeof(fragment_rw),
+	               PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, fd, 0);
+	if (ret != (long)fragment_rw)
+		die("map_fragment_pages(): mmap() failed: %d", ret);
+
+	for (i=0; i<MAX_THREADS; i++)
+	{
+		ret = sys_mmap(ctx[i].jit_fragment_page, PG_SIZE,
+		               PROT_READ|PROT_EXEC, MAP_SHARED|MAP_FIXED, fd, i*PG_SIZE);
+		if (ret != (long)ctx[i].jit_fragment_page)
+			die("map_fragment_pages(): mmap() failed: %d", ret);
+	}
+
+	sys_close(fd);
+}
+
+/* only valid for the fields that live in the jit_fragment page */
+static thread_ctx_t *writable_view(thread_ctx_t *c)
+{
+	return (thread_ctx_t *)(fragment_rw[c-ctx] - offsetof(thread_ctx_t, jit_fragment_page));
+}
+
+thread_ctx_t *writable_ctx(void)
+{
+	return writable_view(get_thread_ctx());
+}
+
+static void init_fragment_page(thread_ctx_t *local_ctx, file_ctx_t *f)
+{
+	thread_ctx_t *rw = writable_view(local_ctx);
+
+	rw->my_addr = local_ctx;
+
+	rw->jit_return_addr = jit_return;
+	rw->runtime_ijmp_addr = runtime_ijmp;
+	rw->jit_fragment_exit_addr = jit_fragment_exit;
+
+	rw->sigwrap_stack_top = &local_ctx->sigwrap_stack[sizeof(local_ctx->sigwrap_stack)/sizeof(long)-1];
+	rw->scratch_stack_top = &local_ctx->user_rsp;
+
+	rw->files = f;
+	rw->sighandler = &sighandler;
+}
+
+static void init_thread_ctx(thread_ctx_t *local_ctx, file_ctx_t *f)
+{
+	char *start = (char *)local_ctx,
+	     *frag  = local_ctx->jit_fragment_page,
+	     *end   = (char *)&local_ctx[1];
 
-	local_ctx->jit_return_addr = jit_return;
-	local_ctx->runtime_ijmp_addr = runtime_ijmp;
-	local_ctx->jit_fragment_exit_addr = jit_fragment_exit;
+	/* clear everything around the jit_fragment page, which stays mapped */
+	long ret = sys_mmap(start, frag-start,
+	                     PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS, -1, 0);
+	ret |= sys_mmap(frag+PG_SIZE, end-frag-PG_SIZE,
+	                 PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS, -1, 0);
 
-	local_ctx->sigwrap_stack_top = &local_ctx->sigwrap_stack[sizeof(local_ctx->sigwrap_stack)/sizeof(long)-1];
-	local_ctx->scratch_stack_top = &local_ctx->user_rsp;
+	if (ret & PG_MASK)
+		die("set_thread_ctx(): mmap() failed\n");
 
-	local_ctx->files = &files;
-	local_ctx->sighandler = &sighandler;
+	memset(fragment_rw[local_ctx-ctx], 0, PG_SIZE);
+	init_fragment_page(local_ctx, f);
 
 	sys_mprotect(&local_ctx->fault_page0, 0x1000, PROT_NONE);
-	sys_mprotect(&local_ctx->jit_fragment_page, PG_SIZE, PROT_EXEC|PROT_READ);
+}
+
+/* after fork() the memfd is still shared with the parent */
+static void unshare_fragment_pages(thread_ctx_t *local_ctx)
+{
+	stack_t altstack = local_ctx->altstack;
+
+	map_fragment_pages();
+	init_fragment_page(local_ctx, local_ctx->files);
+	writable_view(local_ctx)->altstack = altstack;
 }
 
 /* no need for locking, the only risk is doing too much work */
@@ -96,25 +216,78 @@ void purge_caches(char *addr, unsigned long len)
 			clear_jmp_cache(&ctx[i], addr, len);
 }
 
-void protect_ctx(void)
+void set_taint_live(void)
 {
-	sys_mprotect(get_thread_ctx()->jit_fragment_page, PG_SIZE, PROT_EXEC|PROT_READ);
-}
-
-void unprotect_ctx(void)
-{
-	sys_mprotect(get_thread_ctx()->jit_fragment_page, PG_SIZE, PROT_READ|PROT_WRITE);
+	int i;
+	for (i=0; i<MAX_THREADS; i++)
+		if (ctx_map[i] == 1)
+			ctx[i].taint_live = 1;
 }
 
 void init_threads(void)
 {
 	thread_ctx_t *new_ctx = alloc_ctx();
 	mutex_init(&thread_lock);
-	init_thread_ctx(new_ctx);
+	map_fragment_pages();
+	files[0].users = 1;
+	init_thread_ctx(new_ctx, &files[0]);
 	init_tls(new_ctx, sizeof(thread_ctx_t));
-	unprotect_ctx();
 	altstack_setup();
-	protect_ctx();
+}
+
+long clone_helper(unsigned long flags, long *child_sp,
+                  void (*fn)(thread_ctx_t *), thread_ctx_t *arg);
+
+/* Starts fn(helper_ctx) in a new thread with a context of its own, for work
+ * done by minemu itself.  The thread gets all signals blocked, so that guest
+ * signals are never delivered to it.  fn() must call init_helper_thread()
+ * first and must not return.
+ */
+long start_helper_thread(void (*fn)(thread_ctx_t *))
+{
+	long ret;
+	thread_ctx_t *helper_ctx;
+
+	mutex_lock(&thread_lock);
+	helper_ctx = alloc_ctx();
+	if (helper_ctx)
+		ctx_map[helper_ctx-ctx] = HELPER_CTX;
+	mutex_unlock(&thread_lock);
+
+	if (helper_ctx == NULL)
+		return -EAGAIN;
+
+	/* helper threads do not count as users, they never touch the table */
+	init_thread_ctx(helper_ctx, get_thread_ctx()->files);
+
+	/* may be called with signals blocked by syscall_emu(), so keep
+	 * the saved mask in ctx->old_sigset intact
+	 */
+	kernel_sigset_t blockall, oldset;
+	memset(&blockall, 0xff, sizeof(blockall));
+	syscall4(__NR_rt_sigprocmask, SIG_BLOCK, (long)&blockall, (long)&oldset,
+	         sizeof(kernel_sigset_t));
+	ret = clone_helper(CLONE_VM|CLONE_FS|CLONE_FILES|CLONE_SIGHAND|
+	                   CLONE_THREAD|CLONE_SYSVSEM,
+	                   (long *)((long)helper_ctx->scratch_stack_top & ~0xfL),
+	                   fn, helper_ctx);
+	syscall4(__NR_rt_sigprocmask, SIG_SETMASK, (long)&oldset, (long)NULL,
+	         sizeof(kernel_sigset_t));
+
+	if (ret < 0)
+	{
+		mutex_lock(&thread_lock);
+		free_ctx(helper_ctx);
+		mutex_unlock(&thread_lock);
+	}
+
+	return ret;
+}
+
+/* called by helper threads to set up their thread-local context */
+void init_helper_thread(thread_ctx_t *helper_ctx)
+{
+	init_tls(helper_ctx, sizeof(thread_ctx_t));
 }
 
 /* release the lock and exit, without thouching the stack after
@@ -130,13 +303,21 @@ long user_clone(unsigned long flags, unsigned long sp, void *parent_tid, void *t
 {
 	long ret;
 	thread_ctx_t *child_ctx = NULL;
+	file_ctx_t *child_files;
 
 	if (flags & CLONE_VM)
 	{
 		mutex_lock(&thread_lock);
 		child_ctx = alloc_ctx();
+		child_files = clone_files(flags, get_thread_ctx()->files);
+		if (child_files == NULL)
+			free_ctx(child_ctx);
 		mutex_unlock(&thread_lock);
-		init_thread_ctx(child_ctx);
+
+		if (child_files == NULL)
+			return -EAGAIN;
+
+		init_thread_ctx(child_ctx, child_files);
 		int stack_diff = (long)child_ctx - (long)get_thread_ctx();
 		/* I need to change a "this is the most ugly hack ever" comment somewhere else */
 		ret = clone_relocate_stack(flags, sp, parent_tid, tls, child_tid, stack_diff);
@@ -146,22 +327,29 @@ long user_clone(unsigned long flags, unsigned long sp, void *parent_tid, void *t
 		{
 			mutex_lock(&thread_lock);
 			free_ctx(child_ctx);
+			put_files(child_files);
 			mutex_unlock(&thread_lock);
 		}
 		else if (ret == 0)
 		{
 			init_tls(child_ctx, sizeof(thread_ctx_t));
-			unprotect_ctx();
 			altstack_setup();
-			protect_ctx();
 		}
 	}
 	else
 	{
 		child_ctx = get_thread_ctx();
+		/* do not fork in the middle of a translation by another thread */
+		mutex_lock(&jit_lock);
 		ret = sys_clone(flags, 0, parent_tid, tls, child_tid);
+		mutex_unlock(&jit_lock);
 		if (ret == 0)
+		{
 			unshare_ctx(child_ctx);
+			unshare_files(child_ctx->files);
+			unshare_fragment_pages(child_ctx);
+			jit_spec_init();
+		}
 	}
 
 	if (ret == 0 && sp)
@@ -170,10 +358,27 @@ long user_clone(unsigned long flags, unsigned long sp, void *parent_tid, void *t
 	return ret;
 }
 
+int guest_thread_count(void)
+{
+	int i, guest_threads = 0;
+
+	for (i=0; i<MAX_THREADS; i++)
+		if (ctx_map[i] == 1)
+			guest_threads++;
+
+	return guest_threads;
+}
+
 void user_exit(long status)
 {
 	mutex_lock(&thread_lock);
+	put_files(get_thread_ctx()->files);
 	free_ctx(get_thread_ctx());
+
+	/* helper threads should not keep the process alive */
+	if (guest_thread_count() == 0)
+		sys_exit_group(status);
+
 	/* do not touch the scratch stack after releasing it */
 	mutex_unlock_exit(status, &thread_lock);
 }
@@ -182,6 +387,7 @@ long mutex_unlock_execve_or_die(char *filename, char *argv[], char *envp[], long
 long sys_execve_or_die(char *filename, char *argv[], char *envp[])
 {
 	mutex_lock(&thread_lock);
+	put_files(get_thread_ctx()->files);
 	free_ctx(get_thread_ctx());
 	/* do not touch the scratch stack after releasing it */
 	mutex_unlock_execve_or_die(filename, argv, envp, &thread_lock);
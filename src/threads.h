@@ -36,10 +36,24 @@ typedef struct
 
 typedef long (*ijmp_t)(void);
 
+/* the kernel's default fs.nr_open, the table lives in bss so only the
+ * pages covering fds which are actually used get backed by memory
+ */
+#define MAX_FDS (0x100000)
+
+/* fd tables which can exist in one address space at the same time, one per
+ * group of threads sharing their file descriptors (CLONE_FILES)
+ */
+#define MAX_FILE_CTX (8)
+
+/* entries are only changed with compare-and-swap or plain byte stores,
+ * FD_UNKNOWN (0) is always safe, it just gets looked up again
+ */
 typedef struct
 {
-	char fd_type[1024];
-	long lock;
+	char fd_type[MAX_FDS];
+	long high_fd; /* no fds at or above this one have a type */
+	long users;   /* threads using this table, 0: free */
 
 } file_ctx_t;
 
@@ -50,6 +64,18 @@ typedef struct
 
 } sighandler_ctx_t;
 
+/* the register taint of an interrupted thread, kept for sigreturn,
+ * see export_guest_xmm()
+ */
+#define MAX_SIG_TAINT (8)
+
+typedef struct
+{
+	unsigned long fpstate; /* of the guest's signal frame */
+	long taint_xmm[2][2];  /* %xmm6, %xmm7 */
+
+} sig_taint_t;
+
 typedef struct thread_ctx_s thread_ctx_t;
 
 struct thread_ctx_s
@@ -76,7 +102,7 @@ struct thread_ctx_s
 	sighandler_ctx_t *sighandler;             /*   bugs   */
 	stack_t altstack;                         /*    :-)   */
 
-	long scratch_stack[0x2400 - 11 - sizeof(kernel_sigset_t)/sizeof(long)];
+	long scratch_stack[0x2400 - 82 - 5*MAX_SIG_TAINT - 2*sizeof(kernel_sigset_t)/sizeof(long)];
 
 /* this */
 	long user_rsp; /* scratch_stack_top points here */
@@ -93,7 +119,25 @@ struct thread_ctx_s
 	long taint_tmp;
 	long flags_tmp;
 
+	long taint_live; /* checked by bare code, see taint_went_live() */
+
+	long signals_deferred; /* see try_defer_signals() */
+	long deferred_sig;
+	siginfo_t deferred_info;
+
+	long sig_pending; /* checked by jit_return and back edges, see delay_signal() */
+	kernel_sigset_t lazy_sigset;
+
 	kernel_sigset_t old_sigset;
+
+	long sig_taint_depth;
+	sig_taint_t sig_taint[MAX_SIG_TAINT];
+
+/* 16 byte aligned, the struct ends on a page boundary */
+	long guest_xmm[5][2]; /* the guest's %xmm3-%xmm7, see generate_sse() */
+	long xmm_spill[2][2];
+	long xmm_taint[16][2]; /* see taint_sse.c */
+	long xmm_fold[2][2];
 /* gets copied in clone_relocate_stack() as well */
 };
 
@@ -102,17 +146,21 @@ inline thread_ctx_t *get_thread_ctx(void)
 	return (thread_ctx_t *)get_tls_long(offsetof(thread_ctx_t, my_addr));
 }
 
-void protect_ctx(void);
-void unprotect_ctx(void);
+thread_ctx_t *writable_ctx(void);
 
 void init_threads(void);
 
 long user_clone(unsigned long flags, unsigned long sp, void *parent_tid, void *tls, void *child_tid);
 void user_exit(long status);
 
+long start_helper_thread(void (*fn)(thread_ctx_t *));
+void init_helper_thread(thread_ctx_t *helper_ctx);
+
 long sys_execve_or_die(char *filename, char *argv[], char *envp[]);
 
 void purge_caches(char *addr, unsigned long len);
+void set_taint_live(void);
+int guest_thread_count(void);
 
 void mutex_init(long *lock);
 void mutex_lock(long *lock);
@@ -0,0 +1,189 @@
+
+/* This file is part of minemu
+ *
+ * Copyright 2010-2011 Erik Bosman <erik@minemu.org>
+ * Copyright 2011 Vrije Universiteit Amsterdam
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <elf.h>
+#include <string.h>
+#include <linux/unistd.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "vdso.h"
+#include "mm.h"
+#include "taint.h"
+
+/* The vDSO's time functions read the kernel's clock data from pages next
+ * to the vDSO, which the guest's copy does not have.  The entry points in
+ * the copy are replaced by a plain system call, and syscall_emu() passes
+ * the time calls to vdso_time(), which calls the host's vDSO from the
+ * emulator instead of entering the kernel.  System calls made directly by
+ * the guest take the same path.
+ */
+
+typedef long (*clock_gettime_func_t)(long clock, struct timespec *ts);
+typedef long (*gettimeofday_func_t)(struct timeval *tv, struct timezone *tz);
+typedef long (*time_func_t)(long *t);
+
+static clock_gettime_func_t clock_gettime_func = NULL;
+static gettimeofday_func_t gettimeofday_func = NULL;
+static time_func_t time_func = NULL;
+
+static struct
+{
+	const char *name;
+	long call;
+	void **func;
+
+} time_entries[] =
+{
+	{ .name = "__vdso_clock_gettime", .call = __NR_clock_gettime, .func = (void **)&clock_gettime_func },
+	{ .name = "__vdso_gettimeofday",  .call = __NR_gettimeofday,  .func = (void **)&gettimeofday_func },
+	{ .name = "__vdso_time",          .call = __NR_time,          .func = (void **)&time_func },
+	{ .name = NULL },
+};
+
+#ifdef __x86_64__
+static const char syscall_stub[] =
+	"\xb8\x00\x00\x00\x00"              /* mov $call, %eax */
+	"\x0f\x05"                          /* syscall         */
+	"\xc3";                             /* ret             */
+#define STUB_CALL_OFF (1)
+#else
+static const char syscall_stub[] =
+	"\x53"                              /* push %ebx          */
+	"\x8b\x5c\x24\x08"                  /* mov 8(%esp), %ebx  */
+	"\x8b\x4c\x24\x0c"                  /* mov 12(%esp), %ecx */
+	"\xb8\x00\x00\x00\x00"              /* mov $call, %eax    */
+	"\xcd\x80"                          /* int $0x80          */
+	"\x5b"                              /* pop %ebx           */
+	"\xc3";                             /* ret                */
+#define STUB_CALL_OFF (10)
+#endif
+#define STUB_SIZE (sizeof(syscall_stub)-1)
+
+/* offset of a function symbol from the start of the vDSO image, or -1 */
+static long vdso_symbol(char *image, const char *name, unsigned long *size)
+{
+	Elf64_Ehdr *hdr = (Elf64_Ehdr *)image;
+	Elf64_Phdr *phdr = (Elf64_Phdr *)&image[hdr->e_phoff];
+	Elf64_Shdr *shdr = (Elf64_Shdr *)&image[hdr->e_shoff];
+	unsigned long base = 0;
+	unsigned long i, j;
+
+	if ( memcmp(hdr->e_ident, ELFMAG, SELFMAG) != 0 )
+		return -1;
+
+	for (i=0; i<hdr->e_phnum; i++)
+		if ( (phdr[i].p_type == PT_LOAD) && (phdr[i].p_offset == 0) )
+			base = phdr[i].p_vaddr;
+
+	for (i=0; i<hdr->e_shnum; i++)
+	{
+		if ( (shdr[i].sh_type != SHT_DYNSYM) || (shdr[i].sh_link >= hdr->e_shnum) )
+			continue;
+
+		Elf64_Sym *sym = (Elf64_Sym *)&image[shdr[i].sh_offset];
+		char *strtab = &image[shdr[shdr[i].sh_link].sh_offset];
+
+		for (j=0; j<shdr[i].sh_size/sizeof(Elf64_Sym); j++)
+			if ( (ELF64_ST_TYPE(sym[j].st_info) == STT_FUNC) &&
+			     (sym[j].st_shndx != SHN_UNDEF) &&
+			     (strcmp(&strtab[sym[j].st_name], name) == 0) )
+			{
+				*size = sym[j].st_size;
+				return sym[j].st_value - base;
+			}
+	}
+
+	return -1;
+}
+
+void vdso_time_init(char *copy, unsigned long copy_size, char *orig)
+{
+	unsigned long size;
+	long i, off;
+	int call;
+
+	if (orig == NULL)
+		return;
+
+	for (i=0; time_entries[i].name; i++)
+	{
+		off = vdso_symbol(orig, time_entries[i].name, &size);
+
+		if (off < 0)
+			continue;
+
+		*time_entries[i].func = &orig[off];
+
+		if ( (off+STUB_SIZE > copy_size) || (size < STUB_SIZE) )
+			continue;
+
+		call = time_entries[i].call;
+		memcpy(&copy[off], syscall_stub, STUB_SIZE);
+		memcpy(&copy[off+STUB_CALL_OFF], &call, sizeof(call));
+	}
+}
+
+/* the host's vDSO writes through these pointers from inside minemu */
+static int user_ptr(long addr, unsigned long size)
+{
+	return ((unsigned long)addr < USER_END) && ((unsigned long)addr+size <= USER_END);
+}
+
+static void clear_shadow(long addr, unsigned long size)
+{
+	if ( addr && (taint_flag != TAINT_OFF) )
+		taint_mem((void *)addr, size, TAINT_CLEAR);
+}
+
+/* returns 1 if the call has been handled, its result in *ret */
+int vdso_time(long call, long arg1, long arg2, long *ret)
+{
+	switch (call)
+	{
+		case __NR_clock_gettime:
+			if ( !clock_gettime_func || !arg2 || !user_ptr(arg2, sizeof(struct timespec)) )
+				return 0;
+
+			*ret = clock_gettime_func(arg1, (struct timespec *)arg2);
+			clear_shadow(arg2, sizeof(struct timespec));
+			return 1;
+
+		case __NR_gettimeofday:
+			if ( !gettimeofday_func || !user_ptr(arg1, sizeof(struct timeval)) ||
+			                           !user_ptr(arg2, sizeof(struct timezone)) )
+				return 0;
+
+			*ret = gettimeofday_func((struct timeval *)arg1, (struct timezone *)arg2);
+			clear_shadow(arg1, sizeof(struct timeval));
+			clear_shadow(arg2, sizeof(struct timezone));
+			return 1;
+
+		case __NR_time:
+			if ( !time_func || !user_ptr(arg1, sizeof(long)) )
+				return 0;
+
+			*ret = time_func((long *)arg1);
+			clear_shadow(arg1, sizeof(long));
+			return 1;
+
+		default:
+			return 0;
+	}
+}
@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+
+/* Lock contention benchmark: threads fighting over one mutex, and a pair of
+ * threads playing ping-pong with a condition variable.  Both end up in
+ * FUTEX_WAIT / FUTEX_WAKE (_PRIVATE).  A timer keeps interrupting the
+ * waits, the totals are checked to catch lost or doubled wakeups.
+ *
+ * usage: futex_contention [threads] [iterations]
+ */
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static long counter = 0, turn = 0, iterations = 100000;
+static volatile long ticks = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void tick(int sig)
+{
+	ticks++;
+}
+
+static void *contend(void *arg)
+{
+	long i;
+	for (i=0; i<iterations; i++)
+	{
+		pthread_mutex_lock(&lock);
+		counter++;
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+static void *ping_pong(void *arg)
+{
+	long me = (long)arg, i;
+	for (i=0; i<iterations; i++)
+	{
+		pthread_mutex_lock(&lock);
+		while (turn != me)
+			pthread_cond_wait(&cond, &lock);
+		turn = !me;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+	return NULL;
+}
+
+static double run(void *(*func)(void *), long n_threads)
+{
+	pthread_t threads[n_threads];
+	double start = now();
+	long i;
+
+	for (i=0; i<n_threads; i++)
+		if ( pthread_create(&threads[i], NULL, func, (void *)i) )
+		{
+			perror("pthread_create");
+			exit(1);
+		}
+
+	for (i=0; i<n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	return now()-start;
+}
+
+int main(int argc, char **argv)
+{
+	long n_threads = argc > 1 ? atol(argv[1]) : 4;
+	double t;
+
+	if (argc > 2)
+		iterations = atol(argv[2]);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = tick;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGALRM, &sa, NULL);
+
+	struct itimerval timer = { { 0, 1000 }, { 0, 1000 } };
+	setitimer(ITIMER_REAL, &timer, NULL);
+
+	t = run(contend, n_threads);
+	printf("mutex:     %ld threads, %.0f lock/unlock per second\n",
+	       n_threads, n_threads*iterations/t);
+
+	if (counter != n_threads*iterations)
+	{
+		printf("FAIL: counter is %ld, expected %ld\n", counter, n_threads*iterations);
+		return 1;
+	}
+
+	t = run(ping_pong, 2);
+	printf("condvar:   2 threads, %.0f round trips per second\n", iterations/t);
+
+	timer = (struct itimerval){ { 0, 0 }, { 0, 0 } };
+	setitimer(ITIMER_REAL, &timer, NULL);
+
+	printf("%ld timer signals, ok\n", ticks);
+	return 0;
+}
@@ -0,0 +1,52 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+
+typedef void (*func_t)(void);
+
+__attribute__((force_align_arg_pointer))
+void reached(void)
+{
+	printf("called through a tainted pointer\n");
+}
+
+void die(void)
+{
+	perror(__FILE__);
+	exit(1);
+
+}
+
+/* the tainted pointer is called in the same block as the read() which
+ * taints it, with -dualtaint this read() is the first taint source
+ */
+int main(int argc, char *argv[])
+{
+	int filedes[2];
+	if ( pipe(filedes) < 0 )
+		die();
+
+	if (fork() == 0)
+	{
+		func_t function_pointer = reached;
+
+		if ( write(filedes[1], &function_pointer,
+		     sizeof(function_pointer)) != sizeof(function_pointer) )
+			die();
+	}
+	else
+	{
+		func_t tainted_pointer;
+		long call = SYS_read, fd = filedes[0], len = sizeof(tainted_pointer);
+		void *buf = &tainted_pointer;
+
+		__asm__ __volatile__ ("syscall\n\t"
+		                      "call *(%%rsi)"
+		                      : "+a" (call), "+D" (fd), "+S" (buf), "+d" (len)
+		                      :
+		                      : "rcx", "r8", "r9", "r10", "r11", "memory");
+	}
+
+	exit(0);
+}
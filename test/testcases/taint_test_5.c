@@ -0,0 +1,70 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int (*func_t)(int,int);
+
+int add(int a, int b)
+{
+	return a+b;
+}
+
+void die(void)
+{
+	perror(__FILE__);
+	exit(1);
+
+}
+
+/* the tainted pointer only reaches the call through rep movs,
+ * one copy forwards, one backwards, surrounded by rep stos
+ */
+static void rep_copy(void *dst, void *src, unsigned long n, int backwards)
+{
+	if (backwards)
+		__asm__ __volatile__ ("std ; rep movsb ; cld"
+		                      : "+D" (dst), "+S" (src), "+c" (n) :: "memory");
+	else
+		__asm__ __volatile__ ("rep movsb"
+		                      : "+D" (dst), "+S" (src), "+c" (n) :: "memory");
+}
+
+static void rep_fill(void *dst, int c, unsigned long n)
+{
+	__asm__ __volatile__ ("rep stosb" : "+D" (dst), "+c" (n) : "a" (c) : "memory");
+}
+
+int main(int argc, char *argv[])
+{
+	int filedes[2];
+	if ( pipe(filedes) < 0 )
+		die();
+
+	if (fork() == 0)
+	{
+		func_t function_pointer = add;
+
+		if ( write(filedes[1], &function_pointer,
+		     sizeof(function_pointer)) != sizeof(function_pointer) )
+			die();
+	}
+	else
+	{
+		char buf[64], copy[64];
+		func_t tainted_pointer;
+
+		rep_fill(buf, 0, sizeof(buf));
+		if ( read(filedes[0], &buf[16], sizeof(tainted_pointer)) != sizeof(tainted_pointer) )
+			die();
+
+		rep_fill(copy, 0, sizeof(copy));
+		rep_copy(&copy[63], &buf[63], sizeof(buf), 1);
+		rep_copy(&tainted_pointer, &copy[16], sizeof(tainted_pointer), 0);
+
+		int a = 2, b = 2;
+		printf("%d + %d = %d\n", a, b, tainted_pointer(a, b));
+	}
+
+	exit(0);
+}
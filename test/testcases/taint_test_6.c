@@ -0,0 +1,56 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int (*func_t)(int,int);
+
+int add(int a, int b)
+{
+	return a+b;
+}
+
+void die(void)
+{
+	perror(__FILE__);
+	exit(1);
+
+}
+
+/* the tainted pointer only reaches the call through libc string functions,
+ * run with -libcsummary these are replaced by native summaries which have
+ * to carry the taint along
+ */
+int main(int argc, char *argv[])
+{
+	int filedes[2];
+	if ( pipe(filedes) < 0 )
+		die();
+
+	if (fork() == 0)
+	{
+		func_t function_pointer = add;
+
+		if ( write(filedes[1], &function_pointer,
+		     sizeof(function_pointer)) != sizeof(function_pointer) )
+			die();
+	}
+	else
+	{
+		char buf[64], copy[64];
+		func_t tainted_pointer;
+
+		memset(buf, 0, sizeof(buf));
+		if ( read(filedes[0], &buf[16], sizeof(tainted_pointer)) != sizeof(tainted_pointer) )
+			die();
+
+		memset(copy, 0, sizeof(copy));
+		memmove(&copy[8], buf, sizeof(buf)-8);
+		memcpy(&tainted_pointer, &copy[24], sizeof(tainted_pointer));
+
+		int a = 2, b = 2;
+		printf("%d + %d = %d\n", a, b, tainted_pointer(a, b));
+	}
+
+	exit(0);
+}
@@ -0,0 +1,63 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef int (*func_t)(int,int);
+
+int add(int a, int b)
+{
+	return a+b;
+}
+
+void die(void)
+{
+	perror(__FILE__);
+	exit(1);
+
+}
+
+/* the tainted pointer only reaches the call through sse registers:
+ * an unaligned load, a qword swap, and a movq into a general purpose register
+ */
+static func_t sse_copy(char *src)
+{
+	func_t f;
+	__asm__ __volatile__ ("movdqu (%1), %%xmm1\n"
+	                      "pshufd $0x4e, %%xmm1, %%xmm2\n"
+	                      "movq %%xmm2, %0"
+	                      : "=r" (f) : "r" (src) : "xmm1", "xmm2", "memory");
+	return f;
+}
+
+int main(int argc, char *argv[])
+{
+	int filedes[2];
+	if ( pipe(filedes) < 0 )
+		die();
+
+	if (fork() == 0)
+	{
+		func_t function_pointer = add;
+
+		if ( write(filedes[1], &function_pointer,
+		     sizeof(function_pointer)) != sizeof(function_pointer) )
+			die();
+	}
+	else
+	{
+		char buf[64];
+		func_t tainted_pointer;
+
+		memset(buf, 0, sizeof(buf));
+		if ( read(filedes[0], &buf[24], sizeof(tainted_pointer)) != sizeof(tainted_pointer) )
+			die();
+
+		tainted_pointer = sse_copy(&buf[16]);
+
+		int a = 2, b = 2;
+		printf("%d + %d = %d\n", a, b, tainted_pointer(a, b));
+	}
+
+	exit(0);
+}
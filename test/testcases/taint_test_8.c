@@ -0,0 +1,74 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+typedef int (*func_t)(int,int);
+
+int add(int a, int b)
+{
+	return a+b;
+}
+
+void die(void)
+{
+	perror(__FILE__);
+	exit(1);
+
+}
+
+/* the tainted pointer arrives in the second iovec of the second message
+ * of a recvmmsg() call
+ */
+int main(int argc, char *argv[])
+{
+	int sv[2];
+	if ( socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0 )
+		die();
+
+	if (fork() == 0)
+	{
+		func_t function_pointer = add;
+		char pad[8] = { 0, };
+
+		if ( write(sv[1], pad, sizeof(pad)) != sizeof(pad) )
+			die();
+
+		struct iovec iov[2] =
+		{
+			{ .iov_base = pad, .iov_len = sizeof(pad) },
+			{ .iov_base = &function_pointer, .iov_len = sizeof(function_pointer) },
+		};
+		if ( writev(sv[1], iov, 2) != sizeof(pad)+sizeof(function_pointer) )
+			die();
+	}
+	else
+	{
+		char first[8], pad[8];
+		func_t tainted_pointer;
+
+		struct iovec iov0 = { .iov_base = first, .iov_len = sizeof(first) };
+		struct iovec iov1[2] =
+		{
+			{ .iov_base = pad, .iov_len = sizeof(pad) },
+			{ .iov_base = &tainted_pointer, .iov_len = sizeof(tainted_pointer) },
+		};
+		struct mmsghdr msgs[2];
+		memset(msgs, 0, sizeof(msgs));
+		msgs[0].msg_hdr.msg_iov = &iov0;
+		msgs[0].msg_hdr.msg_iovlen = 1;
+		msgs[1].msg_hdr.msg_iov = iov1;
+		msgs[1].msg_hdr.msg_iovlen = 2;
+
+		if ( recvmmsg(sv[0], msgs, 2, 0, NULL) != 2 )
+			die();
+
+		int a = 2, b = 2;
+		printf("%d + %d = %d\n", a, b, tainted_pointer(a, b));
+	}
+
+	exit(0);
+}
@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+typedef int (*func_t)(int,int);
+
+int add(int a, int b)
+{
+	return a+b;
+}
+
+void die(void)
+{
+	perror(__FILE__);
+	exit(1);
+
+}
+
+/* moves fd as high as the hard limit allows, above 1023 if possible */
+int high_fd(int fd)
+{
+	struct rlimit lim;
+	int newfd;
+
+	getrlimit(RLIMIT_NOFILE, &lim);
+	lim.rlim_cur = lim.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &lim);
+
+	if ( (newfd = fcntl(fd, F_DUPFD_CLOEXEC, lim.rlim_cur > 4096 ? 4000 : lim.rlim_cur-1)) < 0 )
+		die();
+
+	close(fd);
+	return newfd;
+}
+
+/* the tainted pointer is read from a socket living at a high fd, after the
+ * fd it came from has been closed and reused for a trusted file
+ */
+int main(int argc, char *argv[])
+{
+	int sv[2];
+	if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0 )
+		die();
+
+	if (fork() == 0)
+	{
+		func_t function_pointer = add;
+
+		if ( write(sv[1], &function_pointer,
+		     sizeof(function_pointer)) != sizeof(function_pointer) )
+			die();
+	}
+	else
+	{
+		func_t tainted_pointer;
+		int old_fd = sv[0];
+		int fd = high_fd(sv[0]);
+
+		printf("socket moved from fd %d to fd %d\n", old_fd, fd);
+
+		if ( open("/bin/sh", O_RDONLY) != old_fd )
+			die();
+
+		if ( read(fd, &tainted_pointer, sizeof(tainted_pointer)) != sizeof(tainted_pointer) )
+			die();
+
+		int a = 2, b = 2;
+		printf("%d + %d = %d\n", a, b, tainted_pointer(a, b));
+	}
+
+	exit(0);
+}